@@ -143,16 +143,10 @@ static int SDLCALL GetCharacterOffsets(void *_font, const char *text, int *byteO
     return i;
 }
 
-static SDL_Texture * SDLCALL RenderText(void *_font, SDL_Renderer *renderer, const char *text, SDL_Color fg)
+static SDL_Surface * SDLCALL RenderTextSurface(void *_font, const char *text, SDL_Color fg)
 {
     TTF_Font *font = (TTF_Font *)_font;
-    SDL_Texture *texture = NULL;
-    SDL_Surface *surface = TTF_RenderText_Blended(font, text, 0, fg);
-    if (surface) {
-        texture = SDL_CreateTextureFromSurface(renderer, surface);
-        SDL_DestroySurface(surface);
-    }
-    return texture;
+    return TTF_RenderText_Blended(font, text, 0, fg);
 }
 
 static void SDLCALL FreeFont(void *_font)
@@ -169,9 +163,44 @@ static void LoadRTF(RTF_Context *ctx, const char *file)
     }
 }
 
+static void Benchmark(RTF_Context *ctx)
+{
+    RTF_TextureStats before, after;
+    SDL_Rect rect;
+    int width;
+
+    /* Only keep one layout, so that every width is laid out from scratch */
+    RTF_SetLazyLayout(ctx, false);
+    RTF_SetLayoutCacheSize(ctx, 1, 0);
+    for (width = 200; width <= 1600; width += 200) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        int height = RTF_GetHeight(ctx, width);
+        Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+
+        SDL_Log("width %4d: height %7d, reflow took %.3f ms\n", width, height,
+                (double)elapsed * 1000.0 / SDL_GetPerformanceFrequency());
+    }
+
+    /* Shrink the window a step at a time, drawing it each time.  Without
+       the atlas each piece of text gets a texture of its own, and the ones
+       the old layout is done with are reused for the new one. */
+    RTF_SetTextureAtlas(ctx, 0);
+    RTF_GetTextureStats(ctx, &before);
+    rect.x = 0;
+    rect.y = 0;
+    rect.h = SCREEN_HEIGHT;
+    for (width = 1600; width >= 200; width -= 20) {
+        rect.w = width;
+        RTF_Render(ctx, &rect, 0);
+    }
+    RTF_GetTextureStats(ctx, &after);
+    SDL_Log("resize: %" SDL_PRIu64 " pieces of text rendered, %" SDL_PRIu64 " of them into reused textures\n",
+            after.misses - before.misses, after.recycled - before.recycled);
+}
+
 static void PrintUsage(const char *argv0)
 {
-    SDL_Log("Usage: %s -fdefault font.ttf [-froman font.ttf] [-fswiss font.ttf] [-fmodern font.ttf] [-fscript font.ttf] [-fdecor font.ttf] [-ftech font.ttf] file.rtf\n", argv0);
+    SDL_Log("Usage: %s [-benchmark] -fdefault font.ttf [-froman font.ttf] [-fswiss font.ttf] [-fmodern font.ttf] [-fscript font.ttf] [-fdecor font.ttf] [-ftech font.ttf] file.rtf\n", argv0);
 }
 
 static void cleanup(void)
@@ -185,6 +214,7 @@ int main(int argc, char *argv[])
     int i, start, stop;
     int w, h;
     int done;
+    bool benchmark = false;
     int height;
     int offset;
     SDL_Window *window;
@@ -209,6 +239,8 @@ int main(int argc, char *argv[])
             FontList[FontFamilyToIndex(RTF_FontDecor)] = argv[++i];
         } else if (SDL_strcmp(argv[i], "-ftech") == 0) {
             FontList[FontFamilyToIndex(RTF_FontTech)] = argv[++i];
+        } else if (SDL_strcmp(argv[i], "-benchmark") == 0) {
+            benchmark = true;
         } else {
             break;
         }
@@ -234,21 +266,35 @@ int main(int argc, char *argv[])
     }
 
     /* Create and load the RTF document */
+    SDL_zero(fontEngine);
     fontEngine.version = RTF_FONT_ENGINE_VERSION;
     fontEngine.CreateFont = CreateFont;
     fontEngine.GetLineSpacing = GetLineSpacing;
     fontEngine.GetCharacterOffsets = GetCharacterOffsets;
-    fontEngine.RenderText = RenderText;
+    fontEngine.RenderText = NULL;
     fontEngine.FreeFont = FreeFont;
+    fontEngine.RenderTextSurface = RenderTextSurface;
     ctx = RTF_CreateContext(renderer, &fontEngine);
     if (!ctx) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create RTF context: %s\n", SDL_GetError());
         cleanup();
         return 5;
     }
+    RTF_SetLazyLayout(ctx, true);
+    RTF_SetBackgroundReflow(ctx, true);
+    RTF_SetReflowThreads(ctx, 0);
+    RTF_SetTextureAtlas(ctx, 1024);
+    RTF_SetColorModulation(ctx, true);
     LoadRTF(ctx, argv[i]);
     SDL_SetWindowTitle(window, RTF_GetTitle(ctx));
 
+    if (benchmark) {
+        Benchmark(ctx);
+        RTF_FreeContext(ctx);
+        cleanup();
+        return 0;
+    }
+
     /* Render the document to the screen */
     done = 0;
     offset = 0;
@@ -256,14 +302,22 @@ int main(int argc, char *argv[])
     height = RTF_GetHeight(ctx, w);
     while (!done) {
         SDL_Event event;
+        bool exposed = false;
+
+        /* The layout is refined as we render, keep the same text in view */
+        height = RTF_GetHeight(ctx, w);
+        offset = RTF_GetAnchoredOffset(ctx);
+
         while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_EVENT_WINDOW_EXPOSED) {
+                exposed = true;
+            }
             if (event.type == SDL_EVENT_WINDOW_RESIZED) {
-                float ratio = (float)offset / height;
                 SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, "Resetting window\n");
                 SDL_GetWindowSize(window, &w, &h);
                 SDL_SetRenderViewport(renderer, NULL);
                 height = RTF_GetHeight(ctx, w);
-                offset = (int)(ratio * height);
+                offset = RTF_GetAnchoredOffset(ctx);
             }
             if (event.type == SDL_EVENT_KEY_DOWN) {
                 switch(event.key.key) {
@@ -327,10 +381,13 @@ int main(int argc, char *argv[])
             }
         }
 
-        SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-        SDL_RenderClear(renderer);
-        RTF_Render(ctx, NULL, offset);
-        SDL_RenderPresent(renderer);
+        /* Only draw when something changed, to stay idle otherwise */
+        if (exposed || RTF_NeedsRender(ctx, NULL, offset)) {
+            SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+            SDL_RenderClear(renderer);
+            RTF_Render(ctx, NULL, offset);
+            SDL_RenderPresent(renderer);
+        }
         SDL_Delay(10);
     }
 
@@ -93,7 +93,7 @@ RTF_FontStyle;
 
 /* Various functions that need to be provided to give SDL_rtf font support */
 
-#define RTF_FONT_ENGINE_VERSION 1
+#define RTF_FONT_ENGINE_VERSION 4
 
 typedef struct _RTF_FontEngine
 {
@@ -115,13 +115,102 @@ typedef struct _RTF_FontEngine
      */
     int (SDLCALL *GetCharacterOffsets)(void *font, const char *text, int *byteOffsets, int *pixelOffsets, int maxOffsets);
 
-    /* Create a texture containing a row of the given UTF-8 text */
+    /* Create a texture containing a row of the given UTF-8 text.
+       This may be NULL if RenderTextSurface or CreateText is provided.
+     */
     SDL_Texture *(SDLCALL *RenderText)(void *font, SDL_Renderer *renderer, const char *text, SDL_Color fg);
 
     /* Free a font */
     void (SDLCALL *FreeFont)(void *font);
+
+    /* The following were added in version 2 */
+
+    /* Create a surface containing a row of the given UTF-8 text, or NULL
+       to always use RenderText.  The texture is made from the surface by
+       SDL_rtf, so this can be called from SDL_rtf's worker threads, and
+       from several of them at once, but never for the same font at once.
+     */
+    SDL_Surface *(SDLCALL *RenderTextSurface)(void *font, const char *text, SDL_Color fg);
+
+    /* The following were added in version 3 */
+
+    /* Create an object that draws a row of the given UTF-8 text, or NULL
+       to render text to textures.  If this is provided, the engine draws
+       all the text itself, for instance from a glyph atlas, and DrawText
+       and DestroyText must be provided too.
+     */
+    void *(SDLCALL *CreateText)(void *font, SDL_Renderer *renderer, const char *text, SDL_Color fg);
+
+    /* Draw text made by CreateText with its top left corner at x, y */
+    bool (SDLCALL *DrawText)(void *text, SDL_Renderer *renderer, float x, float y);
+
+    /* Free text made by CreateText */
+    void (SDLCALL *DestroyText)(void *text);
+
+    /* The following were added in version 4 */
+
+    /* Create a font like CreateFont, for engines that keep state of their
+       own.  If this is provided, CreateFont isn't used.
+     */
+    void *(SDLCALL *CreateFontWithUserdata)(void *userdata, const char *name, RTF_FontFamily family, int charset, int size, int style);
+
+    /* Passed as the first parameter of CreateFontWithUserdata */
+    void *userdata;
 } RTF_FontEngine;
 
+/* Memory allocation functions used by an RTF context */
+
+typedef struct _RTF_Allocator
+{
+    /* Allocate a block of memory of at least the given size */
+    void *(SDLCALL *malloc_func)(void *userdata, size_t size);
+
+    /* Resize a block of memory, which may be NULL, preserving its contents */
+    void *(SDLCALL *realloc_func)(void *userdata, void *mem, size_t size);
+
+    /* Free a block of memory, which may be NULL */
+    void (SDLCALL *free_func)(void *userdata, void *mem);
+
+    /* Passed as the first parameter of each of the functions above */
+    void *userdata;
+} RTF_Allocator;
+
+/**
+ * A callback that is called when text reflowed in the background is ready.
+ *
+ * This is called on the thread doing the reflow, so it should only do
+ * something quick and thread-safe, like pushing an event to wake up the
+ * thread that renders the text. The new layout is used from the next call to
+ * RTF_Render() or RTF_GetHeight() with the same width.
+ *
+ * \param userdata what was passed as `userdata` to RTF_SetLayoutCallback().
+ * \param ctx the RTF context that was reflowed.
+ * \param width the width, in pixels, the text was reflowed to.
+ *
+ * \since This datatype is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetLayoutCallback
+ */
+typedef void (SDLCALL *RTF_LayoutCallback)(void *userdata, RTF_Context *ctx, int width);
+
+/**
+ * Statistics about the textures of the contexts that draw with a renderer.
+ *
+ * \since This struct is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetTextureStats
+ */
+typedef struct RTF_TextureStats
+{
+    Uint64 hits;            /**< text drawn with a texture it already had */
+    Uint64 misses;          /**< text that had to be rendered to a texture */
+    Uint64 recycled;        /**< misses that reused a texture of other text */
+    Uint64 evictions;       /**< textures freed to stay within the budget */
+    int numTextures;        /**< textures in use now */
+    size_t textureBytes;    /**< approximate memory used by them */
+    int numPooled;          /**< textures kept to be reused for other text */
+    size_t pooledBytes;     /**< approximate memory used by them */
+} RTF_TextureStats;
 
 /**
  * Create an RTF display context, with the given font engine.
@@ -137,6 +226,31 @@ typedef struct _RTF_FontEngine
  */
 extern SDL_DECLSPEC RTF_Context * SDLCALL RTF_CreateContext(SDL_Renderer *renderer, RTF_FontEngine *fontEngine);
 
+/**
+ * Create an RTF display context that allocates memory with custom functions.
+ *
+ * This works like RTF_CreateContext(), except that the context itself and
+ * all of the memory it needs for the loaded document, such as text, font
+ * tables, colors and layout, are allocated with the functions in
+ * `allocator`. Memory allocated by the font engine and the renderer, such as
+ * fonts and textures, is not affected, and neither is the texture cache
+ * shared with other contexts that draw with the same renderer.
+ *
+ * The allocator is copied, but its userdata must stay valid until the
+ * context is freed with RTF_FreeContext().
+ *
+ * \param renderer an SDL renderer to use for drawing.
+ * \param fontEngine the font engine to use for rendering text.
+ * \param allocator the memory functions to use, or NULL to use SDL_malloc(),
+ *                  SDL_realloc() and SDL_free().
+ * \returns a new RTF display context, or NULL on error.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_CreateContext
+ */
+extern SDL_DECLSPEC RTF_Context * SDLCALL RTF_CreateContextWithAllocator(SDL_Renderer *renderer, RTF_FontEngine *fontEngine, const RTF_Allocator *allocator);
+
 /**
  * Set the text of an RTF context, with data loaded from a filename.
  *
@@ -176,6 +290,95 @@ extern SDL_DECLSPEC bool SDLCALL RTF_Load(RTF_Context *ctx, const char *file);
  */
 extern SDL_DECLSPEC bool SDLCALL RTF_Load_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio);
 
+/**
+ * Add text to the end of an RTF context, with data loaded from an
+ * SDL_IOStream.
+ *
+ * Parsing continues from where the last call to RTF_Load_IO() or
+ * RTF_Append_IO() left off, using the same font and color tables and the
+ * same formatting. This makes it possible to show a document that is still
+ * growing, like a log or a chat transcript, without loading all of it again
+ * each time more of it arrives. Appending to a context with nothing loaded
+ * starts a new document.
+ *
+ * The data may end in the middle of a group or a paragraph, and the next
+ * append continues it. It should not end in the middle of a control word.
+ *
+ * Only the new text is laid out, at the width the text was last laid out
+ * at, so the cost of appending depends on the size of the new text rather
+ * than the size of the document. Layouts at other widths are thrown away.
+ *
+ * If `closeio` is true, this function will close `src`, whether this function
+ * succeeded or not.
+ *
+ * \param ctx the RTF context to update.
+ * \param src the SDL_IOStream to load RTF data from.
+ * \param closeio true to close `src` when the text is loaded, false to leave
+ *                it open.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_Load_IO
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_Append_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio);
+
+/**
+ * Replace the text of an RTF context with a new version of it, with data
+ * loaded from a filename.
+ *
+ * This is RTF_Reload_IO() for a file.
+ *
+ * \param ctx the RTF context to update.
+ * \param file the file path to load RTF data from.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_Reload_IO
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_Reload(RTF_Context *ctx, const char *file);
+
+/**
+ * Replace the text of an RTF context with a new version of it, with data
+ * loaded from an SDL_IOStream.
+ *
+ * This is meant for showing a document while it is being edited somewhere
+ * else, like a live preview. The new version is parsed in full, and each
+ * of its paragraphs is compared with the current document by a hash of its
+ * text, fonts, colors and paragraph formatting. Paragraphs that didn't
+ * change keep their layout and textures, and only the ones that were added
+ * or changed are laid out, so reloading after a small change is much
+ * cheaper than RTF_Load_IO(). Layouts at widths other than the current one
+ * are thrown away.
+ *
+ * Unchanged paragraphs are found before and after the changes, and between
+ * changes that are close together. Paragraphs that moved far from where
+ * they were are laid out again.
+ *
+ * If the new version can't be parsed, for example because it was read
+ * while it was only partly written, the current document is left as it
+ * was.
+ *
+ * If `closeio` is true, this function will close `src`, whether this function
+ * succeeded or not.
+ *
+ * \param ctx the RTF context to update.
+ * \param src the SDL_IOStream to load RTF data from.
+ * \param closeio true to close `src` when the text is loaded, false to leave
+ *                it open.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_Load_IO
+ * \sa RTF_Reload
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_Reload_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio);
+
 /**
  * Get the title of an RTF document.
  *
@@ -224,20 +427,503 @@ extern SDL_DECLSPEC const char * SDLCALL RTF_GetAuthor(RTF_Context *ctx);
  * The text is automatically reflowed to this new width, and should match the
  * width of the clipping rectangle used for rendering later.
  *
+ * With background reflow, the height of the text at the width it is
+ * currently laid out at is returned until the new layout is ready.
+ *
  * \param ctx the RTF context to query.
  * \param width the width, in pixels, to use for text flow.
  * \returns the height, in pixels, of an RTF render area.
  *
  * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetBackgroundReflow
  */
 extern SDL_DECLSPEC int SDLCALL RTF_GetHeight(RTF_Context *ctx, int width);
 
+/**
+ * Set whether an RTF context lays out text only as it is needed.
+ *
+ * Normally, changing the width used for text flow lays out the whole
+ * document, which can take a long time for large documents. With lazy
+ * layout, lines that are not on screen only get an estimated height when
+ * the width changes. Lines are laid out exactly when they are rendered, and
+ * each call to RTF_Render() spends a little time laying out more of the
+ * document, until the height is exact.
+ *
+ * While estimates are being refined, the height of the document and the
+ * position of text in it can change between renders. Use
+ * RTF_GetAnchoredOffset() to keep the text that was on screen in place.
+ *
+ * Lazy layout is disabled by default.
+ *
+ * \param ctx the RTF context to modify.
+ * \param enabled true to lay out lines as needed, false to lay out the whole
+ *                document at once.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetAnchoredOffset
+ * \sa RTF_IsHeightExact
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetLazyLayout(RTF_Context *ctx, bool enabled);
+
+/**
+ * Set how many layouts of the text an RTF context keeps.
+ *
+ * Laying out the text at a width is remembered, so that switching between a
+ * few widths, such as a narrow and a wide view of the same document, doesn't
+ * reflow the text each time. The least recently used layouts are thrown away
+ * when there are more than `numLayouts` of them, or when they use more than
+ * `maxBytes` of memory, counting the textures created to render them. The
+ * layout at the most recently used width is always kept.
+ *
+ * By default, up to 4 layouts using up to 64 MB are kept.
+ *
+ * \param ctx the RTF context to modify.
+ * \param numLayouts the most layouts to keep, at least 1.
+ * \param maxBytes the most memory, in bytes, to use for them.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_SetLayoutCacheSize(RTF_Context *ctx, int numLayouts, size_t maxBytes);
+
+/**
+ * Set how much texture memory the contexts drawing with a renderer may use.
+ *
+ * The textures of every RTF context created with the same renderer share
+ * one budget. When creating a texture takes them over it, the textures that
+ * were drawn least recently are freed, and their text is rendered again if
+ * it is drawn later. Textures drawn by the latest call to RTF_Render() or
+ * RTF_RenderPage() are never freed this way, so the text on screen stays
+ * even if it doesn't fit in the budget.
+ *
+ * By default there is no budget, and textures are only freed along with
+ * the layouts they belong to, see RTF_SetLayoutCacheSize().
+ *
+ * Textures the text is done with are kept for a few renders, to be reused
+ * for other text when it is laid out again. They count towards the budget
+ * too, and are the first to go when it's reached.
+ *
+ * This should be called on the thread that renders with the renderer.
+ *
+ * \param ctx any RTF context drawing with the renderer.
+ * \param maxBytes the most memory, in bytes, to use for textures, or 0 for
+ *                 no limit.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetTextureStats
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetTextureBudget(RTF_Context *ctx, size_t maxBytes);
+
+/**
+ * Get statistics about the textures of the contexts drawing with a renderer.
+ *
+ * The counts cover every RTF context created with the same renderer, since
+ * the first of them was created. A high number of misses compared to hits
+ * can mean the texture budget is too small for the text being shown.
+ *
+ * This should be called on the thread that renders with the renderer.
+ *
+ * \param ctx any RTF context drawing with the renderer.
+ * \param stats filled in with the statistics.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetTextureBudget
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_GetTextureStats(RTF_Context *ctx, RTF_TextureStats *stats);
+
+/**
+ * Set whether an RTF context draws its text from cached tiles.
+ *
+ * With a tile cache, the text laid out at the current width is drawn into
+ * render target textures, each `tileHeight` pixels tall and as wide as the
+ * text. RTF_Render() then only draws the two or three tiles in view, making
+ * each tile the first time it comes into view, which keeps the cost of
+ * scrolling low however dense the text is. Tiles are made again when the
+ * text in them changes, such as after an edit.
+ *
+ * The tiles count towards the texture budget and the layout cache size,
+ * along with the textures of the text they were made from. If the renderer
+ * can't render to textures, the text is drawn directly as usual.
+ *
+ * Some renderers lose the contents of render targets, such as when the
+ * graphics device is reset. When that happens, SDL sends an
+ * SDL_EVENT_RENDER_TARGETS_RESET event, and the application must call
+ * RTF_ResetRenderTargets() so the tiles are made again.
+ *
+ * By default, text is drawn directly and no tiles are used.
+ *
+ * \param ctx the RTF context to modify.
+ * \param tileHeight the height of each tile, in pixels, or 0 to draw text
+ *                   directly.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_Render
+ * \sa RTF_ResetRenderTargets
+ * \sa RTF_SetTextureBudget
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_SetTileCache(RTF_Context *ctx, int tileHeight);
+
+/**
+ * Throw away the render target textures of an RTF context.
+ *
+ * Call this when the renderer has lost the contents of its render targets,
+ * which SDL reports with an SDL_EVENT_RENDER_TARGETS_RESET event. The tiles
+ * of the tile cache are made again as they come into view, the composite
+ * cache is drawn again from scratch, and RTF_NeedsRender() returns true
+ * until the text has been rendered again.
+ *
+ * \param ctx the RTF context to reset.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_NeedsRender
+ * \sa RTF_SetCompositeCache
+ * \sa RTF_SetTileCache
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_ResetRenderTargets(RTF_Context *ctx);
+
+/**
+ * Set whether an RTF context packs its text into shared atlas textures.
+ *
+ * With an atlas, the text is rendered into square textures `pageSize`
+ * pixels on a side, many pieces of text to a page, and the text in view is
+ * drawn with one SDL_RenderGeometry() call per page instead of one
+ * SDL_RenderTexture() call per piece of text. Pages that are mostly empty
+ * after the text has been laid out again are refilled, and the text still
+ * in them is rendered again the next time it is drawn.
+ *
+ * The pages count towards the texture budget. Text too big for a page gets
+ * a texture of its own.
+ *
+ * This needs a font engine that provides RenderTextSurface. By default, no
+ * atlas is used.
+ *
+ * \param ctx the RTF context to modify.
+ * \param pageSize the width and height of each page, in pixels, or 0 to
+ *                 give each piece of text its own texture.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetTextureBudget
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_SetTextureAtlas(RTF_Context *ctx, int pageSize);
+
+/**
+ * Set whether an RTF context colors text when it's drawn.
+ *
+ * Normally the font engine renders each piece of text in its own color.
+ * With color modulation, text is rendered in white and colored with
+ * SDL_SetTextureColorMod() when it's drawn, or with vertex colors when it's
+ * drawn from an atlas, so the texture of a piece of text doesn't depend on
+ * its color.
+ *
+ * This looks the same for text rendered with alpha blending, like
+ * TTF_RenderText_Blended(), but not for text whose edges are colored, like
+ * LCD subpixel rendering. Text that was already rendered keeps its
+ * textures, and font engines that provide CreateText color their text
+ * themselves. By default, there is no color modulation.
+ *
+ * \param ctx the RTF context to modify.
+ * \param enabled true to render text in white and color it when it's
+ *                drawn, false to render text in its color.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetTextureAtlas
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetColorModulation(RTF_Context *ctx, bool enabled);
+
+/**
+ * Set the number of threads an RTF context uses to reflow text.
+ *
+ * Reflowing a document to a new width lays out each paragraph separately,
+ * so large documents can be laid out by several threads at once. The calling
+ * thread counts as one of them, so a value of 1 disables the extra threads,
+ * which is the default. A value of 0 uses one thread per logical CPU core.
+ *
+ * If the font engine provides RenderTextSurface, the extra threads also
+ * render the text coming into view to surfaces, a font at a time, but the
+ * textures are always created on the thread that calls RTF_Render(). If the
+ * context was created with RTF_CreateContextWithAllocator(), the allocator
+ * may be called from the extra threads and must be thread-safe.
+ *
+ * \param ctx the RTF context to modify.
+ * \param numThreads the number of threads to use, or 0 to pick a number
+ *                   based on the number of CPU cores.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_SetReflowThreads(RTF_Context *ctx, int numThreads);
+
+/**
+ * Set whether an RTF context reflows text to new widths in the background.
+ *
+ * Normally, RTF_Render() and RTF_GetHeight() reflow the text before they
+ * return when the width changes, which can make resizing a window with a
+ * large document stutter. With background reflow, the text is laid out at
+ * the new width on another thread, and the old layout keeps being drawn,
+ * clipped to the new rectangle, until the new one is ready. The first
+ * layout of a document is still made right away, since there is nothing
+ * else to show.
+ *
+ * Use RTF_SetLayoutCallback() or RTF_IsLayoutPending() to find out when
+ * the new layout is in use, and RTF_GetAnchoredOffset() to keep the same
+ * text in view when it is.
+ *
+ * RTF_GetLineAtY() and RTF_GetYOfLine() always wait for the layout at the
+ * width they are given. If the context was created with
+ * RTF_CreateContextWithAllocator(), the allocator is called from the
+ * reflow thread and must be thread-safe.
+ *
+ * Background reflow is disabled by default.
+ *
+ * \param ctx the RTF context to modify.
+ * \param enabled true to reflow text in the background, false to reflow it
+ *                when it is needed.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_IsLayoutPending
+ * \sa RTF_SetLayoutCallback
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetBackgroundReflow(RTF_Context *ctx, bool enabled);
+
+/**
+ * Set a callback for when text reflowed in the background is ready.
+ *
+ * \param ctx the RTF context to modify.
+ * \param callback the function to call, or NULL to remove the callback.
+ * \param userdata a pointer that is passed to `callback`.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_LayoutCallback
+ * \sa RTF_SetBackgroundReflow
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetLayoutCallback(RTF_Context *ctx, RTF_LayoutCallback callback, void *userdata);
+
+/**
+ * Check whether text is still being reflowed to the last width requested.
+ *
+ * This is true from the time RTF_Render() or RTF_GetHeight() is called with
+ * a new width until a call to one of them starts using the layout at that
+ * width. Applications that only render when something changes should keep
+ * rendering while this is true.
+ *
+ * \param ctx the RTF context to query.
+ * \returns true if a new layout is on its way, false if the text is laid
+ *          out at the last width requested.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetBackgroundReflow
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_IsLayoutPending(RTF_Context *ctx);
+
+/**
+ * Check whether the height of an RTF render area is exact.
+ *
+ * With lazy layout, RTF_GetHeight() may return an estimate, which gets more
+ * accurate as the document is rendered. This reports whether every line has
+ * been laid out at the current width.
+ *
+ * \param ctx the RTF context to query.
+ * \returns true if the height is exact, false if it is an estimate.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetHeight
+ * \sa RTF_SetLazyLayout
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_IsHeightExact(RTF_Context *ctx);
+
+/**
+ * Get the offset that keeps the text shown by the last render in place.
+ *
+ * When lines above the view are laid out, or the text is reflowed to a new
+ * width, the text that was at the top of the last call to RTF_Render() can
+ * move. This returns the `yOffset` to pass to the next call to RTF_Render()
+ * so that the same text stays at the top, which avoids content jumping
+ * while scrolling or resizing.
+ *
+ * \param ctx the RTF context to query.
+ * \returns the offset, in pixels, of the text that was at the top of the
+ *          last render, or 0 if nothing has been rendered yet.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_Render
+ * \sa RTF_SetLazyLayout
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetAnchoredOffset(RTF_Context *ctx);
+
+/**
+ * Get the line at a vertical position in an RTF render area.
+ *
+ * A line is a paragraph of the document, which may wrap onto several rows
+ * of text when rendered. Lines are numbered from 0.
+ *
+ * The text is automatically reflowed to the given width, as with
+ * RTF_GetHeight(). Looking up a position takes logarithmic time in the
+ * number of lines.
+ *
+ * \param ctx the RTF context to query.
+ * \param width the width, in pixels, to use for text flow.
+ * \param y the vertical position, in pixels, from the top of the document.
+ * \returns the index of the line containing `y`, or -1 if `y` is outside the
+ *          document; call SDL_GetError() for more information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetYOfLine
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetLineAtY(RTF_Context *ctx, int width, int y);
+
+/**
+ * Get the vertical position of a line in an RTF render area.
+ *
+ * This can be used to scroll a line into view by passing the result as the
+ * `yOffset` of RTF_Render().
+ *
+ * \param ctx the RTF context to query.
+ * \param width the width, in pixels, to use for text flow.
+ * \param line the index of the line, starting from 0.
+ * \returns the position, in pixels, of the top of the line from the top of
+ *          the document, or -1 if `line` is out of range; call
+ *          SDL_GetError() for more information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetLineAtY
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetYOfLine(RTF_Context *ctx, int width, int line);
+
+/**
+ * Get the number of lines in an RTF document.
+ *
+ * \param ctx the RTF context to query.
+ * \returns the number of lines, which is 0 if nothing is loaded.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetLineLength
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetLineCount(RTF_Context *ctx);
+
+/**
+ * Get the number of characters of text in a line of an RTF document.
+ *
+ * Characters are counted as Unicode code points. Tabs are not counted.
+ *
+ * \param ctx the RTF context to query.
+ * \param line the index of the line, starting from 0.
+ * \returns the number of characters in the line, or -1 if `line` is out of
+ *          range; call SDL_GetError() for more information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetLineCount
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetLineLength(RTF_Context *ctx, int line);
+
+/**
+ * Insert text into a line of an RTF document.
+ *
+ * The text gets the font and color of the character before it, or of the
+ * first character of the line if it is inserted at the start. A newline in
+ * the text splits the line in two, and the new line gets the paragraph
+ * formatting of the one it was split from.
+ *
+ * Only the lines that changed are laid out again, at the width the text
+ * was last laid out at, and the lines after them are moved. Layouts at other
+ * widths are thrown away.
+ *
+ * Text can be inserted at the start of an empty document, which creates its
+ * first line.
+ *
+ * \param ctx the RTF context to modify.
+ * \param line the index of the line, starting from 0.
+ * \param offset the number of characters before the insertion point in the
+ *               line, from 0 to the length of the line.
+ * \param text the UTF-8 text to insert.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_DeleteRange
+ * \sa RTF_GetLineLength
+ * \sa RTF_ReplaceParagraph
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_InsertText(RTF_Context *ctx, int line, int offset, const char *text);
+
+/**
+ * Delete text from an RTF document.
+ *
+ * The end of each line counts as one character, so deleting past the end of
+ * a line joins it with the next one, which takes the paragraph formatting of
+ * the first. Deleting more characters than there are stops at the end of
+ * the document.
+ *
+ * As with RTF_InsertText(), only the lines that changed are laid out again.
+ *
+ * \param ctx the RTF context to modify.
+ * \param line the index of the line the text starts in, starting from 0.
+ * \param offset the number of characters before the text in the line.
+ * \param numChars the number of characters to delete.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_InsertText
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_DeleteRange(RTF_Context *ctx, int line, int offset, int numChars);
+
+/**
+ * Replace a line of an RTF document with new RTF text.
+ *
+ * The text is a fragment of RTF, like `{\b Bold} and plain`, which is parsed
+ * with the font and color tables of the document. It starts out with the
+ * paragraph formatting of the line it replaces and plain character
+ * formatting, and can use `\par` to split into several lines.
+ *
+ * If the text can't be parsed, the document is left as it was.
+ *
+ * \param ctx the RTF context to modify.
+ * \param line the index of the line, starting from 0.
+ * \param rtf the RTF text to replace it with.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_InsertText
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_ReplaceParagraph(RTF_Context *ctx, int line, const char *rtf);
+
 /**
  * Render the RTF document to a rectangle in an SDL_Renderer.
  *
  * Rendering is done through the SDL_Renderer specified in RTF_CreateContext.
  *
- * The text is reflowed to match the width of the rectangle.
+ * The text is reflowed to match the width of the rectangle. With background
+ * reflow, the text is drawn as it was last laid out, clipped to the
+ * rectangle, until the layout at the new width is ready.
  *
  * The rendering is offset up (and clipped) by yOffset pixels.
  *
@@ -249,6 +935,210 @@ extern SDL_DECLSPEC int SDLCALL RTF_GetHeight(RTF_Context *ctx, int width);
  */
 extern SDL_DECLSPEC void SDLCALL RTF_Render(RTF_Context *ctx, SDL_Rect *rect, int yOffset);
 
+/**
+ * Find out whether rendering would draw anything different from last time.
+ *
+ * This compares the rectangle and offset with those of the last call to
+ * RTF_Render(), and checks whether the text has changed or moved since
+ * then, such as after loading, editing or reflowing it. It also returns
+ * true while RTF_Render() has work left to do, like laying out lines with
+ * lazy layout or picking up a layout made in the background. An
+ * application that only draws the text can skip presenting frames while
+ * this returns false, but after the renderer loses the contents of its
+ * render targets, it must call RTF_ResetRenderTargets() for this to notice.
+ *
+ * \param ctx the RTF context to query.
+ * \param rect the area the text would be rendered into, or NULL for the
+ *             whole viewport, as with RTF_Render().
+ * \param yOffset the offset that would be passed to RTF_Render().
+ * \returns true if the text should be rendered again, false if it would
+ *          look the same as last time.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetRenderDamage
+ * \sa RTF_Render
+ * \sa RTF_ResetRenderTargets
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_NeedsRender(RTF_Context *ctx, const SDL_Rect *rect, int yOffset);
+
+/**
+ * Get the part of the rectangle that the last render changed.
+ *
+ * This is the area of the last call to RTF_Render() that looks different
+ * from the call before it. When the text was only scrolled by less than
+ * the height of the rectangle, it is the strip that scrolled into view.
+ * When nothing changed, it is empty, and when the text or the rectangle
+ * changed, it is the whole rectangle.
+ *
+ * \param ctx the RTF context to query.
+ * \param damage filled in with the changed area, in the same coordinates
+ *               as the rectangle passed to RTF_Render().
+ * \returns true if part of the rectangle changed, or false if nothing
+ *          changed or on failure; call SDL_GetError() for more information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_NeedsRender
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_GetRenderDamage(RTF_Context *ctx, SDL_Rect *damage);
+
+/**
+ * Set whether an RTF context keeps its last render in a texture.
+ *
+ * With a composite cache, RTF_Render() draws the text into a render target
+ * texture the size of the rectangle, and then draws that texture. When
+ * nothing changed since the last render, the texture is drawn again as it
+ * is, and when the text was only scrolled, the part that was already drawn
+ * is moved over and only the strip that scrolled into view is drawn. This
+ * can be combined with the tile cache.
+ *
+ * The texture counts towards the texture budget. If the renderer can't
+ * render to textures, the text is drawn directly as usual. Like the tile
+ * cache, the texture is a render target, so the application must call
+ * RTF_ResetRenderTargets() on SDL_EVENT_RENDER_TARGETS_RESET.
+ *
+ * By default, there is no composite cache.
+ *
+ * \param ctx the RTF context to modify.
+ * \param enabled true to keep the last render in a texture, false to draw
+ *                the text directly.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetRenderDamage
+ * \sa RTF_ResetRenderTargets
+ * \sa RTF_SetTileCache
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetCompositeCache(RTF_Context *ctx, bool enabled);
+
+/**
+ * Get the number of pages the document takes up when it is printed.
+ *
+ * The first time pages are asked for after the document changes, the text
+ * is laid out at the width between the page margins and split into pages.
+ * The paper size and margins come from the document, and anything it
+ * doesn't set is taken from Letter paper with the default RTF margins. This
+ * layout is separate from the one RTF_Render() uses, and is always exact,
+ * even with lazy layout enabled.
+ *
+ * Pages end between rows of text. A paragraph can continue on the next
+ * page.
+ *
+ * \param ctx the RTF context to query.
+ * \returns the number of pages, which is at least 1, or -1 on failure; call
+ *          SDL_GetError() for more information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetPageSize
+ * \sa RTF_RenderPage
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetPageCount(RTF_Context *ctx);
+
+/**
+ * Get the size of the paper the document is printed on.
+ *
+ * The size is in pixels at 72 dots per inch, the same scale as the rest of
+ * the text.
+ *
+ * \param ctx the RTF context to query.
+ * \param w a pointer filled in with the width of a page, may be NULL.
+ * \param h a pointer filled in with the height of a page, may be NULL.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetPageCount
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_GetPageSize(RTF_Context *ctx, int *w, int *h);
+
+/**
+ * Render the text of a page of the document.
+ *
+ * The page is drawn at its actual size, with the top left corner of the
+ * paper at the top left of the rectangle, and clipped to the rectangle.
+ * Only the text is drawn, the application draws the paper if it wants one.
+ * To draw a page smaller, like for a thumbnail, set a render scale with
+ * SDL_SetRenderScale() first.
+ *
+ * Where each page starts is worked out along with the page count, so
+ * drawing a page only draws the lines on it, however far into the
+ * document it is.
+ *
+ * \param ctx the RTF context to render.
+ * \param page the page to render, starting from 0.
+ * \param rect the area to render the page into, or NULL for a page at the
+ *             top left of the render target.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetPageCount
+ * \sa RTF_GetPageSize
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_RenderPage(RTF_Context *ctx, int page, const SDL_Rect *rect);
+
+/**
+ * Get the page that shows the text at a vertical position in the document.
+ *
+ * The position is in the text laid out at a width, as drawn by
+ * RTF_Render(), so an application scrolling through the document can show
+ * which page it is on. A position part way into a paragraph is matched to
+ * the same fraction of the paragraph on the pages.
+ *
+ * \param ctx the RTF context to query.
+ * \param width the width the text is laid out at.
+ * \param y the vertical position in the document, in pixels.
+ * \returns the index of the page, starting from 0, or -1 on failure; call
+ *          SDL_GetError() for more information. Positions past the end of
+ *          the document are on the last page.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_GetLineAtY
+ * \sa RTF_RenderPage
+ */
+extern SDL_DECLSPEC int SDLCALL RTF_GetPageForY(RTF_Context *ctx, int width, int y);
+
+/**
+ * Unload the current document, keeping resources around for the next one.
+ *
+ * The document is thrown away, but the buffers used to hold its text and
+ * layout are kept, and so are the fonts it was using. Loading another
+ * document into the context afterwards avoids most allocations and reuses
+ * any fonts the two documents have in common. RTF_Load() and RTF_Load_IO()
+ * do this automatically.
+ *
+ * Fonts that are not used by a new document within the font cache timeout
+ * are freed the next time the context is reset.
+ *
+ * \param ctx the RTF context to reset.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_SetFontCacheTimeout
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_ResetContext(RTF_Context *ctx);
+
+/**
+ * Set how long unused fonts are kept after their document is unloaded.
+ *
+ * When a document is reset or replaced, fonts created for it are kept for
+ * this long in case the next document needs them too. The default is 10
+ * seconds. A timeout of 0 frees unused fonts as soon as possible.
+ *
+ * \param ctx the RTF context to modify.
+ * \param ms the time, in milliseconds, to keep unused fonts.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_ResetContext
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_SetFontCacheTimeout(RTF_Context *ctx, Uint32 ms);
+
 /**
  * Free an RTF display context.
  *
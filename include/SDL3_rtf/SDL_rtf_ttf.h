@@ -0,0 +1,103 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+/* A ready made font engine for SDL_rtf, built on SDL_ttf.  It is in the
+   separate SDL3_rtf_ttf library, so SDL_rtf itself doesn't need SDL_ttf. */
+
+#ifndef SDL_RTF_TTF_H_
+#define SDL_RTF_TTF_H_
+
+#include <SDL3/SDL.h>
+#include <SDL3_rtf/SDL_rtf.h>
+#include <SDL3/SDL_begin_code.h>
+
+/* Set up for C function definitions, even when using C++ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Set the font file an engine uses for a font family.
+ *
+ * The fonts an RTF document asks for are matched by family only. Families
+ * without a file of their own use the file of RTF_FontDefault, which has to
+ * be set before any text can be displayed.
+ *
+ * Each file is loaded into memory once, and shared by every size and style
+ * of it that a document uses, even across engines. Fonts that a context has
+ * already created keep the file they were created from.
+ *
+ * \param engine a font engine made by RTF_CreateTTFFontEngine().
+ * \param family the font family to set the file for.
+ * \param file the path of a TrueType or OpenType font file, or NULL to use
+ *             the default file for the family.
+ * \returns true on success or false on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_CreateTTFFontEngine
+ */
+extern SDL_DECLSPEC bool SDLCALL RTF_SetTTFFontFile(RTF_FontEngine *engine, RTF_FontFamily family, const char *file);
+
+/**
+ * Create a font engine that draws text with SDL_ttf.
+ *
+ * The engine draws text through an SDL_ttf renderer text engine, which keeps
+ * the glyphs in its own atlas textures, so the text doesn't need textures
+ * of its own. Characters are measured with SDL_ttf's text shaping.
+ *
+ * TTF_Init() must be called before this, and the engine must be destroyed
+ * before TTF_Quit() is called or the renderer is destroyed.
+ *
+ * \param renderer the renderer the text will be drawn with.
+ * \returns a font engine to pass to RTF_CreateContext() with the same
+ *          renderer, or NULL on failure; call SDL_GetError() for more
+ *          information.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_CreateContext
+ * \sa RTF_DestroyTTFFontEngine
+ * \sa RTF_SetTTFFontFile
+ */
+extern SDL_DECLSPEC RTF_FontEngine * SDLCALL RTF_CreateTTFFontEngine(SDL_Renderer *renderer);
+
+/**
+ * Destroy a font engine made by RTF_CreateTTFFontEngine().
+ *
+ * Every context using the engine must be freed first.
+ *
+ * \param engine the font engine to destroy.
+ *
+ * \since This function is available since SDL_rtf 3.0.0.
+ *
+ * \sa RTF_CreateTTFFontEngine
+ */
+extern SDL_DECLSPEC void SDLCALL RTF_DestroyTTFFontEngine(RTF_FontEngine *engine);
+
+/* Ends C function definitions when using C++ */
+#ifdef __cplusplus
+}
+#endif
+#include <SDL3/SDL_close_code.h>
+
+#endif /* SDL_RTF_TTF_H_ */
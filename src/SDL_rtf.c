@@ -25,6 +25,8 @@
 #include "rtftype.h"
 #include "rtfdecl.h"
 #include "SDL_rtfreadr.h"
+#include "SDL_rtftexture.h"
+#include "SDL_rtfworker.h"
 
 /* rcg06192001 get linked library's version. */
 int RTF_Version(void)
@@ -32,56 +34,123 @@ int RTF_Version(void)
     return SDL_RTF_VERSION;
 }
 
+static void * SDLCALL DefaultMalloc(void *userdata, size_t size)
+{
+    (void)userdata;
+    return SDL_malloc(size);
+}
+
+static void * SDLCALL DefaultRealloc(void *userdata, void *mem, size_t size)
+{
+    (void)userdata;
+    return SDL_realloc(mem, size);
+}
+
+static void SDLCALL DefaultFree(void *userdata, void *mem)
+{
+    (void)userdata;
+    SDL_free(mem);
+}
+
 /* Create an RTF display context, with the given font engine.
  * Once a context is created, it can be used to load and display
  * text in Microsoft RTF format.
  */
 RTF_Context *RTF_CreateContext(SDL_Renderer *renderer, RTF_FontEngine *fontEngine)
 {
+    return RTF_CreateContextWithAllocator(renderer, fontEngine, NULL);
+}
+
+/* Create an RTF display context, with the given font engine and memory
+ * functions, which are used for everything the context allocates.
+ */
+RTF_Context *RTF_CreateContextWithAllocator(SDL_Renderer *renderer, RTF_FontEngine *fontEngine, const RTF_Allocator *allocator)
+{
+    static const RTF_Allocator defaultAllocator = {
+        DefaultMalloc, DefaultRealloc, DefaultFree, NULL
+    };
     RTF_Context *ctx;
+    size_t engineSize;
 
-    if (fontEngine->version != RTF_FONT_ENGINE_VERSION) {
+    switch (fontEngine->version) {
+    case 1:
+        engineSize = offsetof(RTF_FontEngine, RenderTextSurface);
+        break;
+    case 2:
+        engineSize = offsetof(RTF_FontEngine, CreateText);
+        break;
+    case 3:
+        engineSize = offsetof(RTF_FontEngine, CreateFontWithUserdata);
+        break;
+    case 4:
+        engineSize = sizeof(*fontEngine);
+        break;
+    default:
             SDL_SetError("Unknown font engine version");
             return NULL;
     }
+    if (!fontEngine->CreateFont &&
+        (fontEngine->version < 4 || !fontEngine->CreateFontWithUserdata)) {
+        SDL_SetError("Font engine can't create fonts");
+        return NULL;
+    }
+    if (!fontEngine->RenderText &&
+        (fontEngine->version < 2 || !fontEngine->RenderTextSurface) &&
+        (fontEngine->version < 3 || !fontEngine->CreateText)) {
+        SDL_SetError("Font engine can't render text");
+        return NULL;
+    }
+    if (fontEngine->version >= 3 && fontEngine->CreateText &&
+        (!fontEngine->DrawText || !fontEngine->DestroyText)) {
+        SDL_SetError("Font engine can't draw or free its text");
+        return NULL;
+    }
 
-    ctx = (RTF_Context *)SDL_malloc(sizeof(*ctx));
+    if (!allocator) {
+        allocator = &defaultAllocator;
+    } else if (!allocator->malloc_func || !allocator->realloc_func || !allocator->free_func) {
+        SDL_SetError("Incomplete allocator");
+        return NULL;
+    }
+
+    ctx = (RTF_Context *)allocator->malloc_func(allocator->userdata, sizeof(*ctx));
     if (!ctx) {
             SDL_SetError("Out of memory");
             return NULL;
     }
     SDL_memset(ctx, 0, sizeof(*ctx));
+    ctx->allocator = *allocator;
+    ctx->fontCacheTimeout = RTF_DEFAULT_FONT_CACHE_TIMEOUT;
+    ctx->layoutCacheCount = RTF_DEFAULT_LAYOUT_CACHE_COUNT;
+    ctx->layoutCacheBytes = RTF_DEFAULT_LAYOUT_CACHE_BYTES;
     ctx->renderer = renderer;
-    ctx->fontEngine = (RTF_FontEngine *)SDL_malloc(sizeof *fontEngine);
+    ctx->fontEngine = (RTF_FontEngine *)RTF_malloc(ctx, sizeof *fontEngine);
     if (!ctx->fontEngine) {
         SDL_SetError("Out of memory");
-        SDL_free(ctx);
+        RTF_free(ctx, ctx);
         return NULL;
     }
-    SDL_memcpy(ctx->fontEngine, fontEngine, sizeof(*fontEngine));
+    SDL_memset(ctx->fontEngine, 0, sizeof(*fontEngine));
+    SDL_memcpy(ctx->fontEngine, fontEngine, engineSize);
+    ctx->fontEngineInstance = fontEngine;
+    ctx->textureCache = RTF_AcquireTextureCache(renderer);
+    if (!ctx->textureCache) {
+        SDL_SetError("Out of memory");
+        RTF_free(ctx, ctx->fontEngine);
+        RTF_free(ctx, ctx);
+        return NULL;
+    }
+    ctx->composites[0].texture = -1;
+    ctx->composites[1].texture = -1;
     return ctx;
 }
 
-/* Set the text of an RTF context.
- * This function returns true if it succeeds or false if it fails.
- * Use SDL_GetError() to get a text message corresponding to the error.
- */
-bool RTF_Load_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio)
+/* Set the error message for a parser error code, returns true for ecOK */
+static bool CheckStatus(int status)
 {
     bool retval;
 
-    ecClearContext(ctx);
-
-    /* Set up the input stream for loading */
-    ctx->rds = 0;
-    ctx->ris = 0;
-    ctx->cbBin = 0;
-    ctx->fSkipDestIfUnk = 0;
-    ctx->stream = src;
-    ctx->nextch = -1;
-
-    /* Parse the RTF text and clean up */
-    switch (ecRtfParse(ctx)) {
+    switch (status) {
         case ecOK:
             retval = true;
             break;
@@ -113,10 +182,76 @@ bool RTF_Load_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio)
             retval = SDL_SetError("Unknown error");
             break;
     }
+    return retval;
+}
+
+/* Parse RTF text from a stream into the context.  When appending, the text
+ * may stop in the middle of a group, and is continued by the next append.
+ */
+static bool ParseRTF(RTF_Context *ctx, SDL_IOStream *src, bool append)
+{
+    int status;
+
+    ctx->stream = src;
+    ctx->nextch = -1;
+
+    status = ecRtfParse(ctx);
+    if (append) {
+        if (status == ecUnmatchedBrace) {
+            status = ecOK;
+        }
+        if (status == ecOK) {
+            status = ecProcessData(ctx);
+        }
+    }
+    ctx->stream = NULL;
+    return CheckStatus(status);
+}
+
+/* Set the text of an RTF context.
+ * This function returns true if it succeeds or false if it fails.
+ * Use SDL_GetError() to get a text message corresponding to the error.
+ */
+bool RTF_Load_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio)
+{
+    bool retval;
+
+    ecResetContext(ctx);
+
+    /* Set up the input stream for loading */
+    ctx->rds = 0;
+    ctx->ris = 0;
+    ctx->cbBin = 0;
+    ctx->fSkipDestIfUnk = 0;
+
+    /* Parse the RTF text and clean up */
+    retval = ParseRTF(ctx, src, false);
     while (ctx->psave) {
         ecPopRtfState(ctx);
     }
-    ctx->stream = NULL;
+
+    if (closeio) {
+        SDL_CloseIO(src);
+    }
+    return retval;
+}
+
+/* Add more text to the end of an RTF context, continuing from where the
+ * last load or append left off, and lay out only the new lines.
+ */
+bool RTF_Append_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio)
+{
+    bool retval;
+    int numLines;
+
+    /* The reflow thread may be reading the text we're about to extend */
+    ecWaitForReflow(ctx);
+
+    numLines = ctx->numLines;
+    retval = ParseRTF(ctx, src, true);
+    if (ecAppendLayout(ctx, numLines) != ecOK && retval) {
+        retval = SDL_OutOfMemory();
+    }
 
     if (closeio) {
         SDL_CloseIO(src);
@@ -133,6 +268,46 @@ bool RTF_Load(RTF_Context *ctx, const char *file)
     return RTF_Load_IO(ctx, src, 1);
 }
 
+/* Replace the text of an RTF context with a new version of it, keeping the
+ * layout of the lines that didn't change.  If the new version can't be
+ * parsed, the old one stays.
+ */
+bool RTF_Reload_IO(RTF_Context *ctx, SDL_IOStream *src, bool closeio)
+{
+    RTF_LineMatch *matches;
+    int numOldLines;
+    int status;
+    bool retval;
+
+    /* The reflow thread may be reading the text we're about to replace */
+    ecWaitForReflow(ctx);
+
+    ctx->stream = src;
+    ctx->nextch = -1;
+    status = ecReloadText(ctx, &matches, &numOldLines);
+    ctx->stream = NULL;
+
+    retval = CheckStatus(status);
+    if (retval && ecReloadLayout(ctx, matches, numOldLines) != ecOK) {
+        retval = SDL_OutOfMemory();
+    }
+    RTF_free(ctx, matches);
+
+    if (closeio) {
+        SDL_CloseIO(src);
+    }
+    return retval;
+}
+
+bool RTF_Reload(RTF_Context *ctx, const char *file)
+{
+    SDL_IOStream *src = SDL_IOFromFile(file, "rb");
+    if (!src) {
+        return false;
+    }
+    return RTF_Reload_IO(ctx, src, 1);
+}
+
 /* Get the title of an RTF document */
 const char *RTF_GetTitle(RTF_Context *ctx)
 {
@@ -157,8 +332,301 @@ const char *RTF_GetAuthor(RTF_Context *ctx)
  */
 int RTF_GetHeight(RTF_Context *ctx, int width)
 {
-    ecReflowText(ctx, width);
-    return ctx->displayHeight;
+    if (ecRequestReflow(ctx, width) != ecOK) {
+        SDL_OutOfMemory();
+        return 0;
+    }
+    return ctx->layout->height;
+}
+
+/* Choose whether lines are laid out only as they are needed */
+void RTF_SetLazyLayout(RTF_Context *ctx, bool enabled)
+{
+    if (ctx->lazyLayout != enabled) {
+        RTF_ClearLayouts(ctx, true);
+        ctx->lazyLayout = enabled;
+    }
+}
+
+/* Choose whether text is reflowed to new widths on another thread */
+void RTF_SetBackgroundReflow(RTF_Context *ctx, bool enabled)
+{
+    if (!enabled) {
+        ecWaitForReflow(ctx);
+    }
+    ctx->backgroundReflow = enabled;
+}
+
+/* Set a function to call when a layout made in the background is ready */
+void RTF_SetLayoutCallback(RTF_Context *ctx, RTF_LayoutCallback callback, void *userdata)
+{
+    /* A reflow in progress may be about to call the old one */
+    ecWaitForReflow(ctx);
+    ctx->layoutCallback = callback;
+    ctx->layoutCallbackData = userdata;
+}
+
+/* Find out whether the text is still being reflowed to the last width */
+bool RTF_IsLayoutPending(RTF_Context *ctx)
+{
+    if (ctx->reflowThread) {
+        return true;
+    }
+    return ctx->layout && ctx->layout->width != ctx->requestedWidth;
+}
+
+/* Find out whether the document height is exact or an estimate */
+bool RTF_IsHeightExact(RTF_Context *ctx)
+{
+    return !ctx->layout || ctx->layout->numEstimated == 0;
+}
+
+/* Get the offset that keeps the text at the top of the last render in view */
+int RTF_GetAnchoredOffset(RTF_Context *ctx)
+{
+    return ecAnchoredOffset(ctx);
+}
+
+/* Set how many layouts at different widths are kept around */
+bool RTF_SetLayoutCacheSize(RTF_Context *ctx, int numLayouts, size_t maxBytes)
+{
+    if (numLayouts < 1) {
+        return SDL_InvalidParamError("numLayouts");
+    }
+    ctx->layoutCacheCount = numLayouts;
+    ctx->layoutCacheBytes = maxBytes;
+    return true;
+}
+
+/* Set how much texture memory the contexts drawing with a renderer share */
+void RTF_SetTextureBudget(RTF_Context *ctx, size_t maxBytes)
+{
+    RTF_SetTextureCacheBudget(ctx->textureCache, maxBytes);
+}
+
+/* Get how well the textures of a renderer's contexts are being reused */
+bool RTF_GetTextureStats(RTF_Context *ctx, RTF_TextureStats *stats)
+{
+    if (!stats) {
+        return SDL_InvalidParamError("stats");
+    }
+    RTF_GetTextureCacheStats(ctx->textureCache, stats);
+    return true;
+}
+
+/* Set the height of the tiles text is drawn from, or 0 to not use tiles */
+bool RTF_SetTileCache(RTF_Context *ctx, int tileHeight)
+{
+    if (tileHeight < 0) {
+        return SDL_InvalidParamError("tileHeight");
+    }
+    ecSetTileHeight(ctx, tileHeight);
+    return true;
+}
+
+/* Throw away the render targets, after the renderer lost their contents */
+void RTF_ResetRenderTargets(RTF_Context *ctx)
+{
+    ecResetRenderTargets(ctx);
+}
+
+/* Set the size of the atlas pages text is packed into, or 0 to not pack it */
+bool RTF_SetTextureAtlas(RTF_Context *ctx, int pageSize)
+{
+    if (pageSize < 0) {
+        return SDL_InvalidParamError("pageSize");
+    }
+    if (pageSize > 0 && !((RTF_FontEngine *)ctx->fontEngine)->RenderTextSurface) {
+        return SDL_SetError("Font engine can't render text to surfaces");
+    }
+    if (ecSetTextureAtlas(ctx, pageSize) != ecOK) {
+        return SDL_OutOfMemory();
+    }
+    return true;
+}
+
+/* Set whether text is rendered in white and colored when it's drawn */
+void RTF_SetColorModulation(RTF_Context *ctx, bool enabled)
+{
+    ctx->colorModulation = enabled;
+}
+
+/* Set the number of threads used to reflow text */
+bool RTF_SetReflowThreads(RTF_Context *ctx, int numThreads)
+{
+    RTF_WorkerPool *workers = NULL;
+
+    if (numThreads < 0) {
+        return SDL_InvalidParamError("numThreads");
+    }
+    if (numThreads == 0) {
+        numThreads = SDL_GetNumLogicalCPUCores();
+    }
+    if (numThreads == RTF_GetWorkerCount(ctx->workers)) {
+        return true;
+    }
+
+    /* A reflow in the background may be using the threads */
+    ecWaitForReflow(ctx);
+
+    /* The calling thread does its share of the work */
+    if (numThreads > 1) {
+        workers = RTF_CreateWorkerPool(ctx, numThreads - 1);
+        if (!workers) {
+            return SDL_SetError("Couldn't create reflow threads");
+        }
+    }
+    RTF_DestroyWorkerPool(ctx, ctx->workers);
+    ctx->workers = workers;
+    return true;
+}
+
+/* Get the index of the line at a vertical position in the document */
+int RTF_GetLineAtY(RTF_Context *ctx, int width, int y)
+{
+    int line;
+
+    if (ecReflowText(ctx, width) != ecOK) {
+        SDL_OutOfMemory();
+        return -1;
+    }
+    line = ecLineAtY(ctx, y);
+    if (y < 0 || line >= ctx->numLines) {
+        SDL_SetError("Position is outside the document");
+        return -1;
+    }
+    return line;
+}
+
+/* Get the vertical position of the top of a line in the document */
+int RTF_GetYOfLine(RTF_Context *ctx, int width, int line)
+{
+    if (ecReflowText(ctx, width) != ecOK) {
+        SDL_OutOfMemory();
+        return -1;
+    }
+    if (line < 0 || line >= ctx->numLines) {
+        SDL_SetError("Line %d is outside the document", line);
+        return -1;
+    }
+    return ctx->layout->lines[line].y;
+}
+
+/* Get the number of lines in the document */
+int RTF_GetLineCount(RTF_Context *ctx)
+{
+    return ctx->numLines;
+}
+
+/* Get the number of characters of text in a line */
+int RTF_GetLineLength(RTF_Context *ctx, int line)
+{
+    if (line < 0 || line >= ctx->numLines) {
+        SDL_SetError("Line %d is outside the document", line);
+        return -1;
+    }
+    return ecLineLength(ctx, line);
+}
+
+/* Check that a position can be edited.  An empty document can be edited
+ * at the start of its first line, which is created by the edit.
+ */
+static bool CheckPosition(RTF_Context *ctx, int line, int offset)
+{
+    if (ctx->numLines == 0 && line == 0 && offset == 0) {
+        return true;
+    }
+    if (line < 0 || line >= ctx->numLines) {
+        return SDL_SetError("Line %d is outside the document", line);
+    }
+    if (offset < 0 || offset > ecLineLength(ctx, line)) {
+        return SDL_SetError("Offset %d is outside line %d", offset, line);
+    }
+    return true;
+}
+
+/* Update the layout after an edit, if the edit worked */
+static bool FinishEdit(RTF_Context *ctx, int status, const RTF_Edit *edit)
+{
+    if (status == ecOK && ecEditLayout(ctx, edit) != ecOK) {
+        return SDL_OutOfMemory();
+    }
+    return CheckStatus(status);
+}
+
+/* Insert text into a line of the document */
+bool RTF_InsertText(RTF_Context *ctx, int line, int offset, const char *text)
+{
+    RTF_Edit edit;
+
+    if (!text) {
+        return SDL_InvalidParamError("text");
+    }
+    if (!CheckPosition(ctx, line, offset)) {
+        return false;
+    }
+
+    /* The reflow thread may be reading the text we're about to change */
+    ecWaitForReflow(ctx);
+    return FinishEdit(ctx, ecEditText(ctx, line, offset, 0, text, &edit), &edit);
+}
+
+/* Delete text from the document, starting in a line */
+bool RTF_DeleteRange(RTF_Context *ctx, int line, int offset, int numChars)
+{
+    RTF_Edit edit;
+
+    if (numChars < 0) {
+        return SDL_InvalidParamError("numChars");
+    }
+    if (!CheckPosition(ctx, line, offset)) {
+        return false;
+    }
+    if (numChars == 0 || ctx->numLines == 0) {
+        return true;
+    }
+
+    ecWaitForReflow(ctx);
+    return FinishEdit(ctx, ecEditText(ctx, line, offset, numChars, "", &edit), &edit);
+}
+
+/* Replace a line of the document with RTF text */
+bool RTF_ReplaceParagraph(RTF_Context *ctx, int line, const char *rtf)
+{
+    SDL_IOStream *src;
+    RTF_Edit edit;
+    int status;
+
+    if (!rtf) {
+        return SDL_InvalidParamError("rtf");
+    }
+    if (!CheckPosition(ctx, line, 0)) {
+        return false;
+    }
+    src = SDL_IOFromConstMem(rtf, SDL_strlen(rtf));
+    if (!src) {
+        return false;
+    }
+
+    ecWaitForReflow(ctx);
+    ctx->stream = src;
+    ctx->nextch = -1;
+    status = ecReplaceLine(ctx, line, &edit);
+    ctx->stream = NULL;
+    SDL_CloseIO(src);
+    return FinishEdit(ctx, status, &edit);
+}
+
+/* Get the rectangle to render to, the whole viewport if rect is NULL */
+static const SDL_Rect *GetRenderRect(RTF_Context *ctx, const SDL_Rect *rect, SDL_Rect *fullRect)
+{
+    if (!rect) {
+        SDL_GetRenderViewport((SDL_Renderer *)ctx->renderer, fullRect);
+        fullRect->x = 0;
+        fullRect->y = 0;
+        rect = fullRect;
+    }
+    return rect;
 }
 
 /* Render the RTF document to a rectangle of a surface.
@@ -167,15 +635,113 @@ int RTF_GetHeight(RTF_Context *ctx, int width)
 */
 void RTF_Render(RTF_Context *ctx, SDL_Rect *rect, int yOffset)
 {
-    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
     SDL_Rect fullRect;
+
+    ecRenderText(ctx, GetRenderRect(ctx, rect, &fullRect), -yOffset);
+}
+
+/* Find out whether rendering would draw anything different from last time */
+bool RTF_NeedsRender(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+{
+    SDL_Rect fullRect;
+
+    return ecNeedsRender(ctx, GetRenderRect(ctx, rect, &fullRect), -yOffset);
+}
+
+/* Get the part of the rectangle that the last render changed */
+bool RTF_GetRenderDamage(RTF_Context *ctx, SDL_Rect *damage)
+{
+    if (!damage) {
+        return SDL_InvalidParamError("damage");
+    }
+    if (!ctx->rendered) {
+        SDL_zerop(damage);
+        return false;
+    }
+    *damage = ctx->damage;
+    return !SDL_RectEmpty(damage);
+}
+
+/* Set whether the last render is kept in a texture and reused */
+void RTF_SetCompositeCache(RTF_Context *ctx, bool enabled)
+{
+    ecSetCompositeCache(ctx, enabled);
+}
+
+/* Get the number of pages the document takes up when printed */
+int RTF_GetPageCount(RTF_Context *ctx)
+{
+    if (ecPaginate(ctx) != ecOK) {
+        SDL_OutOfMemory();
+        return -1;
+    }
+    return ctx->numPages;
+}
+
+/* Get the size of the paper the document is printed on */
+bool RTF_GetPageSize(RTF_Context *ctx, int *w, int *h)
+{
+    if (ecPaginate(ctx) != ecOK) {
+        return SDL_OutOfMemory();
+    }
+    if (w) {
+        *w = ctx->pageWidth;
+    }
+    if (h) {
+        *h = ctx->pageHeight;
+    }
+    return true;
+}
+
+/* Render the text of a page, with the paper's top left corner at the
+   top left of the rectangle */
+bool RTF_RenderPage(RTF_Context *ctx, int page, const SDL_Rect *rect)
+{
+    SDL_Rect pageRect;
+
+    if (ecPaginate(ctx) != ecOK) {
+        return SDL_OutOfMemory();
+    }
+    if (page < 0 || page >= ctx->numPages) {
+        return SDL_SetError("Page %d is outside the document", page);
+    }
     if (!rect) {
-        SDL_GetRenderViewport(renderer, &fullRect);
-        fullRect.x = 0;
-        fullRect.y = 0;
-        rect = &fullRect;
+        pageRect.x = 0;
+        pageRect.y = 0;
+        pageRect.w = ctx->pageWidth;
+        pageRect.h = ctx->pageHeight;
+        rect = &pageRect;
     }
-    ecRenderText(ctx, rect, -yOffset);
+    ecRenderPage(ctx, page, rect);
+    return true;
+}
+
+/* Get the page that shows a vertical position of the text at a width */
+int RTF_GetPageForY(RTF_Context *ctx, int width, int y)
+{
+    /* Paginating can change the current layout, so it goes first */
+    if (ecPaginate(ctx) != ecOK || ecReflowText(ctx, width) != ecOK) {
+        SDL_OutOfMemory();
+        return -1;
+    }
+    if (y < 0) {
+        SDL_SetError("Position is outside the document");
+        return -1;
+    }
+    return ecPageAtY(ctx, y);
+}
+
+/* Throw away the loaded document, keeping memory and fonts for reuse */
+void RTF_ResetContext(RTF_Context *ctx)
+{
+    ecResetContext(ctx);
+}
+
+/* Set how long unused fonts are kept around after a document is unloaded */
+void RTF_SetFontCacheTimeout(RTF_Context *ctx, Uint32 ms)
+{
+    ctx->fontCacheTimeout = ms;
+    ecEvictFonts(ctx, false);
 }
 
 /* Free an RTF display context */
@@ -183,6 +749,9 @@ void RTF_FreeContext(RTF_Context *ctx)
 {
     /* Free it all! */
     ecClearContext(ctx);
-    SDL_free(ctx->fontEngine);
-    SDL_free(ctx);
+    ecSetTextureAtlas(ctx, 0);
+    RTF_ReleaseTextureCache(ctx->textureCache);
+    RTF_DestroyWorkerPool(ctx, ctx->workers);
+    RTF_free(ctx, ctx->fontEngine);
+    RTF_free(ctx, ctx);
 }
@@ -0,0 +1,353 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <SDL3/SDL.h>
+#include <SDL3_ttf/SDL_ttf.h>
+#include <SDL3_rtf/SDL_rtf.h>
+#include <SDL3_rtf/SDL_rtf_ttf.h>
+
+#define NUM_FONT_FAMILIES   (RTF_FontBidi + 1)
+
+/* A font file loaded into memory, shared by every size and style of it */
+typedef struct RTF_TTFFace
+{
+    char *file;
+    void *data;
+    size_t size;
+    int refcount;
+    struct RTF_TTFFace *next;
+} RTF_TTFFace;
+
+typedef struct RTF_TTFEngine
+{
+    RTF_FontEngine engine;
+    TTF_TextEngine *textEngine;
+    char *fontFiles[NUM_FONT_FAMILIES];
+} RTF_TTFEngine;
+
+typedef struct RTF_TTFFont
+{
+    TTF_Font *font;
+    RTF_TTFFace *face;
+    RTF_TTFEngine *engine;
+} RTF_TTFFont;
+
+/* The loaded files are shared by all the engines.  The lock guards them
+   and the font file names, which fonts may be created from on any thread. */
+static SDL_SpinLock lock;
+static RTF_TTFFace *faces;
+
+static RTF_TTFFace *FindFace(const char *file)
+{
+    RTF_TTFFace *face;
+
+    for (face = faces; face; face = face->next) {
+        if (SDL_strcmp(face->file, file) == 0) {
+            return face;
+        }
+    }
+    return NULL;
+}
+
+static RTF_TTFFace *AcquireFace(RTF_TTFEngine *engine, RTF_FontFamily family)
+{
+    char **fontFiles = engine->fontFiles;
+    char *file;
+    RTF_TTFFace *face;
+    RTF_TTFFace *loaded;
+
+    SDL_LockSpinlock(&lock);
+    if ((int)family < 0 || (int)family >= NUM_FONT_FAMILIES || !fontFiles[family]) {
+        family = RTF_FontDefault;
+    }
+    if (!fontFiles[family]) {
+        SDL_UnlockSpinlock(&lock);
+        SDL_SetError("No font file set for RTF_FontDefault");
+        return NULL;
+    }
+    face = FindFace(fontFiles[family]);
+    if (face) {
+        ++face->refcount;
+        SDL_UnlockSpinlock(&lock);
+        return face;
+    }
+    file = SDL_strdup(fontFiles[family]);
+    SDL_UnlockSpinlock(&lock);
+
+    /* Load the file without holding the lock */
+    if (!file) {
+        return NULL;
+    }
+    loaded = (RTF_TTFFace *)SDL_calloc(1, sizeof(*loaded));
+    if (!loaded) {
+        SDL_free(file);
+        return NULL;
+    }
+    loaded->file = file;
+    loaded->data = SDL_LoadFile(file, &loaded->size);
+    if (!loaded->data) {
+        SDL_free(file);
+        SDL_free(loaded);
+        return NULL;
+    }
+
+    /* Somebody else may have loaded it in the meantime */
+    SDL_LockSpinlock(&lock);
+    face = FindFace(file);
+    if (face) {
+        ++face->refcount;
+    } else {
+        face = loaded;
+        face->refcount = 1;
+        face->next = faces;
+        faces = face;
+        loaded = NULL;
+    }
+    SDL_UnlockSpinlock(&lock);
+
+    if (loaded) {
+        SDL_free(loaded->data);
+        SDL_free(loaded->file);
+        SDL_free(loaded);
+    }
+    return face;
+}
+
+static void ReleaseFace(RTF_TTFFace *face)
+{
+    RTF_TTFFace **prev;
+
+    SDL_LockSpinlock(&lock);
+    if (--face->refcount > 0) {
+        SDL_UnlockSpinlock(&lock);
+        return;
+    }
+    for (prev = &faces; *prev; prev = &(*prev)->next) {
+        if (*prev == face) {
+            *prev = face->next;
+            break;
+        }
+    }
+    SDL_UnlockSpinlock(&lock);
+
+    SDL_free(face->data);
+    SDL_free(face->file);
+    SDL_free(face);
+}
+
+static void * SDLCALL CreateFont(void *userdata, const char *name, RTF_FontFamily family, int charset, int size, int style)
+{
+    RTF_TTFEngine *engine = (RTF_TTFEngine *)userdata;
+    RTF_TTFFont *instance;
+    SDL_IOStream *src;
+    int TTF_style = TTF_STYLE_NORMAL;
+
+    (void)name;
+    (void)charset;
+
+    instance = (RTF_TTFFont *)SDL_malloc(sizeof(*instance));
+    if (!instance) {
+        return NULL;
+    }
+    instance->engine = engine;
+    instance->face = AcquireFace(engine, family);
+    if (!instance->face) {
+        SDL_free(instance);
+        return NULL;
+    }
+
+    /* Each size and style is its own font, so text keeps the size it was
+       laid out with, and fonts can be measured on different threads. */
+    src = SDL_IOFromConstMem(instance->face->data, instance->face->size);
+    instance->font = src ? TTF_OpenFontIO(src, true, (float)size) : NULL;
+    if (!instance->font) {
+        ReleaseFace(instance->face);
+        SDL_free(instance);
+        return NULL;
+    }
+
+    if (style & RTF_FontBold) {
+        TTF_style |= TTF_STYLE_BOLD;
+    }
+    if (style & RTF_FontItalic) {
+        TTF_style |= TTF_STYLE_ITALIC;
+    }
+    if (style & RTF_FontUnderline) {
+        TTF_style |= TTF_STYLE_UNDERLINE;
+    }
+    TTF_SetFontStyle(instance->font, TTF_style);
+
+    /* FIXME: What do we do with the character set? */
+
+    return instance;
+}
+
+static int SDLCALL GetLineSpacing(void *_font)
+{
+    RTF_TTFFont *instance = (RTF_TTFFont *)_font;
+    return TTF_GetFontLineSkip(instance->font);
+}
+
+static int SDLCALL GetCharacterOffsets(void *_font, const char *text, int *byteOffsets, int *pixelOffsets, int maxOffsets)
+{
+    RTF_TTFFont *instance = (RTF_TTFFont *)_font;
+    TTF_Text *shaped;
+    TTF_SubString substring;
+    int length = (int)SDL_strlen(text);
+    int offset = 0;
+    int width = 0;
+    int i = 0;
+
+    /* Measure the shaped text, so kerning and ligatures are accounted for */
+    shaped = TTF_CreateText(NULL, instance->font, text, 0);
+    if (!shaped) {
+        return 0;
+    }
+    while (offset < length && i < maxOffsets) {
+        if (!TTF_GetTextSubString(shaped, offset, &substring) ||
+            substring.length <= 0) {
+            break;
+        }
+        byteOffsets[i] = substring.offset;
+        pixelOffsets[i] = substring.rect.x;
+        ++i;
+
+        offset = substring.offset + substring.length;
+    }
+    if (i < maxOffsets) {
+        TTF_GetTextSize(shaped, &width, NULL);
+        byteOffsets[i] = offset;
+        pixelOffsets[i] = width;
+    }
+    TTF_DestroyText(shaped);
+    return i;
+}
+
+static void SDLCALL FreeFont(void *_font)
+{
+    RTF_TTFFont *instance = (RTF_TTFFont *)_font;
+    TTF_CloseFont(instance->font);
+    ReleaseFace(instance->face);
+    SDL_free(instance);
+}
+
+static void * SDLCALL CreateText(void *_font, SDL_Renderer *renderer, const char *text, SDL_Color fg)
+{
+    RTF_TTFFont *instance = (RTF_TTFFont *)_font;
+    TTF_Text *shaped;
+
+    (void)renderer;
+
+    /* A color without alpha is drawn opaque, rather than not at all */
+    if (fg.a == SDL_ALPHA_TRANSPARENT) {
+        fg.a = SDL_ALPHA_OPAQUE;
+    }
+    shaped = TTF_CreateText(instance->engine->textEngine, instance->font, text, 0);
+    if (shaped) {
+        TTF_SetTextColor(shaped, fg.r, fg.g, fg.b, fg.a);
+    }
+    return shaped;
+}
+
+static bool SDLCALL DrawText(void *text, SDL_Renderer *renderer, float x, float y)
+{
+    (void)renderer;
+    return TTF_DrawRendererText((TTF_Text *)text, x, y);
+}
+
+static void SDLCALL DestroyText(void *text)
+{
+    TTF_DestroyText((TTF_Text *)text);
+}
+
+bool RTF_SetTTFFontFile(RTF_FontEngine *fontEngine, RTF_FontFamily family, const char *file)
+{
+    RTF_TTFEngine *engine = (RTF_TTFEngine *)fontEngine;
+    char *copy = NULL;
+
+    if (!engine) {
+        return SDL_InvalidParamError("engine");
+    }
+    if ((int)family < 0 || (int)family >= NUM_FONT_FAMILIES) {
+        return SDL_InvalidParamError("family");
+    }
+    if (file) {
+        copy = SDL_strdup(file);
+        if (!copy) {
+            return false;
+        }
+    }
+
+    SDL_LockSpinlock(&lock);
+    SDL_free(engine->fontFiles[family]);
+    engine->fontFiles[family] = copy;
+    SDL_UnlockSpinlock(&lock);
+
+    return true;
+}
+
+RTF_FontEngine *RTF_CreateTTFFontEngine(SDL_Renderer *renderer)
+{
+    RTF_TTFEngine *engine;
+
+    if (!renderer) {
+        SDL_InvalidParamError("renderer");
+        return NULL;
+    }
+
+    engine = (RTF_TTFEngine *)SDL_calloc(1, sizeof(*engine));
+    if (!engine) {
+        return NULL;
+    }
+    engine->textEngine = TTF_CreateRendererTextEngine(renderer);
+    if (!engine->textEngine) {
+        SDL_free(engine);
+        return NULL;
+    }
+
+    engine->engine.version = RTF_FONT_ENGINE_VERSION;
+    engine->engine.GetLineSpacing = GetLineSpacing;
+    engine->engine.GetCharacterOffsets = GetCharacterOffsets;
+    engine->engine.FreeFont = FreeFont;
+    engine->engine.CreateText = CreateText;
+    engine->engine.DrawText = DrawText;
+    engine->engine.DestroyText = DestroyText;
+    engine->engine.CreateFontWithUserdata = CreateFont;
+    engine->engine.userdata = engine;
+
+    return &engine->engine;
+}
+
+void RTF_DestroyTTFFontEngine(RTF_FontEngine *fontEngine)
+{
+    RTF_TTFEngine *engine = (RTF_TTFEngine *)fontEngine;
+    int i;
+
+    if (!engine) {
+        return;
+    }
+
+    for (i = 0; i < NUM_FONT_FAMILIES; ++i) {
+        SDL_free(engine->fontFiles[i]);
+    }
+    TTF_DestroyRendererTextEngine(engine->textEngine);
+    SDL_free(engine);
+}
@@ -0,0 +1,453 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <SDL3_rtf/SDL_rtf.h>
+#include "SDL_rtfatlas.h"
+#include "SDL_rtftexture.h"
+
+#include "rtfdecl.h"
+
+/* Empty pixels to the right and below each piece of text */
+#define RTF_ATLAS_PADDING   1
+
+/* A row of text of about the same height, filled from left to right */
+typedef struct _RTF_AtlasShelf
+{
+    int y;
+    int h;
+    int x;                      /* where the next piece of text goes */
+}
+RTF_AtlasShelf;
+
+typedef struct _RTF_AtlasPage
+{
+    int texture;                /* slot in the texture cache, or -1 */
+    Uint32 generation;
+    RTF_AtlasShelf *shelves;
+    int numShelves;
+    int maxShelves;
+    int top;                    /* bottom of the last shelf */
+    int packed;                 /* area given out since the page was empty */
+    int used;                   /* area of the text still using it */
+
+    /* The pieces of text to draw from the page, four vertices each */
+    SDL_Texture *drawTexture;
+    SDL_Vertex *vertices;
+    int numQuads;
+    int maxQuads;
+}
+RTF_AtlasPage;
+
+struct _RTF_Atlas
+{
+    int pageSize;
+    RTF_AtlasPage *pages;
+    int numPages;
+    int maxPages;
+    size_t textureBytes;        /* of all the pages, for the texture cache */
+
+    /* Two triangles for each quad, shared by the pages */
+    int *indices;
+    int maxIndexQuads;
+};
+
+/* static function prototypes */
+static void ResetPage(RTF_Context *ctx, RTF_AtlasPage *page);
+static bool PlaceSurface(RTF_Context *ctx, RTF_Atlas *atlas,
+        RTF_AtlasPage *page, int w, int h, SDL_Point *position);
+static RTF_AtlasPage *FindSparsePage(RTF_Atlas *atlas);
+static RTF_AtlasPage *AddPage(RTF_Context *ctx, RTF_Atlas *atlas);
+static SDL_Texture *GetPageTexture(RTF_Context *ctx, RTF_Atlas *atlas,
+        RTF_AtlasPage *page);
+static bool UploadSurface(SDL_Texture *texture, SDL_Surface *pixels,
+        const SDL_Point *position);
+static RTF_AtlasPage *FindPage(RTF_Atlas *atlas, int slot);
+static bool GrowIndices(RTF_Context *ctx, RTF_Atlas *atlas, int numQuads);
+
+/*
+ * %%Function: RTF_CreateAtlas
+ *
+ * Create an atlas with square pages of the given size.  The pages are
+ * only made when there is text to put in them.
+ */
+RTF_Atlas *RTF_CreateAtlas(RTF_Context *ctx, int pageSize)
+{
+    RTF_Atlas *atlas;
+
+    atlas = (RTF_Atlas *) RTF_malloc(ctx, sizeof(*atlas));
+    if (!atlas)
+        return NULL;
+    SDL_memset(atlas, 0, sizeof(*atlas));
+    atlas->pageSize = pageSize;
+    return atlas;
+}
+
+/*
+ * %%Function: RTF_GetAtlasPageSize
+ */
+int RTF_GetAtlasPageSize(RTF_Atlas *atlas)
+{
+    return atlas ? atlas->pageSize : 0;
+}
+
+/*
+ * %%Function: RTF_PackAtlasSurface
+ *
+ * Copy the pixels of a piece of text into a page with room for them.  When
+ * no page has room, a page that is mostly holes left by text that is gone
+ * is emptied and filled again, which makes the text still in it render
+ * again the next time it is drawn.  Returns the page texture, with its
+ * slot and generation in the texture cache and where the text is in it,
+ * or NULL if the text doesn't fit in a page or there is no memory for it.
+ */
+SDL_Texture *RTF_PackAtlasSurface(RTF_Context *ctx, RTF_Atlas *atlas,
+        SDL_Surface *pixels, int *slot, Uint32 *generation,
+        SDL_Point *position)
+{
+    int w = pixels->w + RTF_ATLAS_PADDING;
+    int h = pixels->h + RTF_ATLAS_PADDING;
+    RTF_AtlasPage *page = NULL;
+    SDL_Texture *texture;
+    int i;
+
+    if (w > atlas->pageSize || h > atlas->pageSize)
+        return NULL;
+
+    for (i = 0; i < atlas->numPages; ++i)
+    {
+        /* A page evicted from the texture cache starts over */
+        if (!RTF_IsTextureCached(ctx->textureCache,
+                atlas->pages[i].texture, atlas->pages[i].generation))
+            ResetPage(ctx, &atlas->pages[i]);
+        if (PlaceSurface(ctx, atlas, &atlas->pages[i], w, h, position))
+        {
+            page = &atlas->pages[i];
+            break;
+        }
+    }
+    if (!page)
+    {
+        page = FindSparsePage(atlas);
+        if (page)
+            ResetPage(ctx, page);
+        else
+            page = AddPage(ctx, atlas);
+        if (!page || !PlaceSurface(ctx, atlas, page, w, h, position))
+            return NULL;
+    }
+
+    texture = GetPageTexture(ctx, atlas, page);
+    if (!texture || !UploadSurface(texture, pixels, position))
+    {
+        page->used -= w * h;
+        return NULL;
+    }
+    *slot = page->texture;
+    *generation = page->generation;
+    return texture;
+}
+
+/*
+ * %%Function: RTF_ReleaseAtlasSurface
+ *
+ * Give back the room a piece of text of the given size took in its page.
+ * Nothing happens if the page has been emptied since the text was put in
+ * it.
+ */
+void RTF_ReleaseAtlasSurface(RTF_Atlas *atlas, int slot, Uint32 generation,
+        int w, int h)
+{
+    RTF_AtlasPage *page = FindPage(atlas, slot);
+
+    if (!page || page->generation != generation)
+        return;
+    page->used -= (w + RTF_ATLAS_PADDING) * (h + RTF_ATLAS_PADDING);
+    if (page->used <= 0)
+    {
+        /* Keep the texture, but start filling it from the top again */
+        page->used = 0;
+        page->packed = 0;
+        page->numShelves = 0;
+        page->top = 0;
+    }
+}
+
+/*
+ * %%Function: RTF_QueueAtlasSurface
+ *
+ * Add a piece of text to the ones to draw from a page, colored with the
+ * given color.  Returns false if there is no memory for it, in which case
+ * it should be drawn directly.
+ */
+bool RTF_QueueAtlasSurface(RTF_Context *ctx, RTF_Atlas *atlas, int slot,
+        SDL_Texture *texture, const SDL_FRect *srcRect,
+        const SDL_FRect *dstRect, SDL_Color color)
+{
+    RTF_AtlasPage *page = FindPage(atlas, slot);
+    float scale = 1.0f / atlas->pageSize;
+    SDL_Vertex *vertex;
+    int i;
+
+    if (!page)
+        return false;
+    if (!GrowIndices(ctx, atlas, page->numQuads + 1) ||
+            ecGrowArray(ctx, (void **)&page->vertices, &page->maxQuads,
+                    page->numQuads, 4 * sizeof(*vertex)) != ecOK)
+        return false;
+
+    page->drawTexture = texture;
+    vertex = &page->vertices[page->numQuads++ * 4];
+    for (i = 0; i < 4; ++i)
+    {
+        float right = (float)(i & 1);
+        float bottom = (float)(i >> 1);
+
+        vertex[i].position.x = dstRect->x + right * dstRect->w;
+        vertex[i].position.y = dstRect->y + bottom * dstRect->h;
+        vertex[i].color.r = color.r / 255.0f;
+        vertex[i].color.g = color.g / 255.0f;
+        vertex[i].color.b = color.b / 255.0f;
+        vertex[i].color.a = color.a / 255.0f;
+        vertex[i].tex_coord.x = (srcRect->x + right * srcRect->w) * scale;
+        vertex[i].tex_coord.y = (srcRect->y + bottom * srcRect->h) * scale;
+    }
+    return true;
+}
+
+/*
+ * %%Function: RTF_DrawAtlas
+ *
+ * Draw the text queued for each page, with one call per page.
+ */
+void RTF_DrawAtlas(RTF_Atlas *atlas, SDL_Renderer *renderer)
+{
+    int i;
+
+    for (i = 0; i < atlas->numPages; ++i)
+    {
+        RTF_AtlasPage *page = &atlas->pages[i];
+
+        if (page->numQuads == 0)
+            continue;
+        SDL_RenderGeometry(renderer, page->drawTexture, page->vertices,
+                page->numQuads * 4, atlas->indices, page->numQuads * 6);
+        page->numQuads = 0;
+    }
+}
+
+/*
+ * %%Function: RTF_DestroyAtlas
+ *
+ * Free the atlas and its pages.  The text that was in them renders again
+ * the next time it is drawn.
+ */
+void RTF_DestroyAtlas(RTF_Context *ctx, RTF_Atlas *atlas)
+{
+    int i;
+
+    if (!atlas)
+        return;
+
+    for (i = 0; i < atlas->numPages; ++i)
+    {
+        ResetPage(ctx, &atlas->pages[i]);
+        RTF_free(ctx, atlas->pages[i].shelves);
+        RTF_free(ctx, atlas->pages[i].vertices);
+    }
+    RTF_free(ctx, atlas->pages);
+    RTF_free(ctx, atlas->indices);
+    RTF_free(ctx, atlas);
+}
+
+/* Free the texture of a page and forget what was in it */
+static void ResetPage(RTF_Context *ctx, RTF_AtlasPage *page)
+{
+    RTF_RemoveCachedTexture(ctx->textureCache, page->texture,
+            page->generation);
+    page->texture = -1;
+    page->numShelves = 0;
+    page->top = 0;
+    page->packed = 0;
+    page->used = 0;
+}
+
+/*
+ * Find room in a page, on the lowest shelf that is tall enough and not
+ * much taller, or on a new shelf, or failing that on any shelf it fits.
+ */
+static bool PlaceSurface(RTF_Context *ctx, RTF_Atlas *atlas,
+        RTF_AtlasPage *page, int w, int h, SDL_Point *position)
+{
+    RTF_AtlasShelf *shelf = NULL;
+    int i;
+
+    for (i = 0; i < page->numShelves; ++i)
+    {
+        RTF_AtlasShelf *s = &page->shelves[i];
+
+        if (s->h >= h && s->h <= h + h / 4 && s->x + w <= atlas->pageSize &&
+                (!shelf || s->h < shelf->h))
+            shelf = s;
+    }
+    if (!shelf && page->top + h <= atlas->pageSize &&
+            ecGrowArray(ctx, (void **)&page->shelves, &page->maxShelves,
+                    page->numShelves, sizeof(*shelf)) == ecOK)
+    {
+        shelf = &page->shelves[page->numShelves++];
+        shelf->y = page->top;
+        shelf->h = h;
+        shelf->x = 0;
+        page->top += h;
+    }
+    for (i = 0; !shelf && i < page->numShelves; ++i)
+    {
+        RTF_AtlasShelf *s = &page->shelves[i];
+
+        if (s->h >= h && s->x + w <= atlas->pageSize)
+            shelf = s;
+    }
+    if (!shelf)
+        return false;
+
+    position->x = shelf->x;
+    position->y = shelf->y;
+    shelf->x += w;
+    page->packed += w * h;
+    page->used += w * h;
+    return true;
+}
+
+/*
+ * Find the page with the least text in it, if more than half of what was
+ * put in it since it was empty is gone.  Pages with text waiting to be
+ * drawn from them are left alone.
+ */
+static RTF_AtlasPage *FindSparsePage(RTF_Atlas *atlas)
+{
+    RTF_AtlasPage *sparse = NULL;
+    int i;
+
+    for (i = 0; i < atlas->numPages; ++i)
+    {
+        RTF_AtlasPage *page = &atlas->pages[i];
+
+        if (page->numQuads == 0 && page->used < page->packed / 2 &&
+                (!sparse || page->used < sparse->used))
+            sparse = page;
+    }
+    return sparse;
+}
+
+static RTF_AtlasPage *AddPage(RTF_Context *ctx, RTF_Atlas *atlas)
+{
+    RTF_AtlasPage *page;
+
+    if (ecGrowArray(ctx, (void **)&atlas->pages, &atlas->maxPages,
+            atlas->numPages, sizeof(*page)) != ecOK)
+        return NULL;
+    page = &atlas->pages[atlas->numPages++];
+    SDL_memset(page, 0, sizeof(*page));
+    page->texture = -1;
+    return page;
+}
+
+/* Get the texture of a page, making it if it hasn't been made yet */
+static SDL_Texture *GetPageTexture(RTF_Context *ctx, RTF_Atlas *atlas,
+        RTF_AtlasPage *page)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    SDL_Texture *texture;
+
+    texture = RTF_GetCachedTexture(ctx->textureCache, page->texture,
+            page->generation);
+    if (texture)
+        return texture;
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_STATIC, atlas->pageSize, atlas->pageSize);
+    if (!texture)
+        return NULL;
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+    page->texture = RTF_AddCachedTexture(ctx->textureCache, texture,
+            (size_t)atlas->pageSize * atlas->pageSize * 4, false,
+            &atlas->textureBytes, &page->generation);
+    if (page->texture < 0)
+        return NULL;
+    return texture;
+}
+
+static bool UploadSurface(SDL_Texture *texture, SDL_Surface *pixels,
+        const SDL_Point *position)
+{
+    SDL_Surface *converted = NULL;
+    SDL_Rect rect;
+    bool result;
+
+    if (pixels->format != SDL_PIXELFORMAT_ARGB8888)
+    {
+        converted = SDL_ConvertSurface(pixels, SDL_PIXELFORMAT_ARGB8888);
+        if (!converted)
+            return false;
+        pixels = converted;
+    }
+
+    rect.x = position->x;
+    rect.y = position->y;
+    rect.w = pixels->w;
+    rect.h = pixels->h;
+    result = SDL_UpdateTexture(texture, &rect, pixels->pixels,
+            pixels->pitch);
+    SDL_DestroySurface(converted);
+    return result;
+}
+
+static RTF_AtlasPage *FindPage(RTF_Atlas *atlas, int slot)
+{
+    int i;
+
+    for (i = 0; i < atlas->numPages; ++i)
+    {
+        if (atlas->pages[i].texture == slot)
+            return &atlas->pages[i];
+    }
+    return NULL;
+}
+
+/* Make sure the index array covers enough quads */
+static bool GrowIndices(RTF_Context *ctx, RTF_Atlas *atlas, int numQuads)
+{
+    static const int quad[6] = { 0, 1, 2, 2, 1, 3 };
+    int first = atlas->maxIndexQuads;
+    int i;
+
+    if (numQuads <= first)
+        return true;
+    if (ecGrowArray(ctx, (void **)&atlas->indices, &atlas->maxIndexQuads,
+            first, 6 * sizeof(*atlas->indices)) != ecOK)
+        return false;
+    for (i = first * 6; i < atlas->maxIndexQuads * 6; ++i)
+    {
+        atlas->indices[i] = (i / 6) * 4 + quad[i % 6];
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef _SDL_RTFATLAS_H
+#define _SDL_RTFATLAS_H
+
+#include <SDL3/SDL.h>
+#include "rtftype.h"
+
+/* Large textures with many pieces of text packed into them, so text can be
+   drawn with one call per texture instead of one per piece.  The pages
+   are kept in the texture cache, and a piece of text refers to its page by
+   the page's slot and generation there. */
+typedef struct _RTF_Atlas RTF_Atlas;
+
+RTF_Atlas *RTF_CreateAtlas(RTF_Context *ctx, int pageSize);
+int RTF_GetAtlasPageSize(RTF_Atlas *atlas);
+SDL_Texture *RTF_PackAtlasSurface(RTF_Context *ctx, RTF_Atlas *atlas,
+        SDL_Surface *pixels, int *slot, Uint32 *generation,
+        SDL_Point *position);
+void RTF_ReleaseAtlasSurface(RTF_Atlas *atlas, int slot, Uint32 generation,
+        int w, int h);
+bool RTF_QueueAtlasSurface(RTF_Context *ctx, RTF_Atlas *atlas, int slot,
+        SDL_Texture *texture, const SDL_FRect *srcRect,
+        const SDL_FRect *dstRect, SDL_Color color);
+void RTF_DrawAtlas(RTF_Atlas *atlas, SDL_Renderer *renderer);
+void RTF_DestroyAtlas(RTF_Context *ctx, RTF_Atlas *atlas);
+
+#endif /* _SDL_RTFATLAS_H */
@@ -21,18 +21,161 @@
 
 #include <SDL3_rtf/SDL_rtf.h>
 #include "SDL_rtfreadr.h"
+#include "SDL_rtftexture.h"
+#include "SDL_rtfworker.h"
+#include "SDL_rtfatlas.h"
 
 #include "rtftype.h"
 #include "rtfdecl.h"
 
+/* How long to spend refining estimated line heights after each render */
+#define RTF_REFINE_BUDGET_NS    SDL_MS_TO_NS(2)
+
+/* Split reflow across threads only when each job gets this many lines */
+#define RTF_MIN_LINES_PER_JOB   256
+#define RTF_MAX_REFLOW_JOBS     64
+
+/* A range of lines to reflow, along with the surfaces for them.  Reflow on
+   the calling thread uses the layout's own surface array, worker threads
+   fill their own arrays, which are merged afterwards. */
+typedef struct _ReflowJob
+{
+    RTF_Context *ctx;
+    RTF_Layout *layout;
+    int width;
+    int firstLine;
+    int numLines;
+    RTF_Surface *surfaces;
+    int numSurfaces;
+    int maxSurfaces;
+}
+ReflowJob;
+
+/* Text to render to surfaces on a worker thread.  Every piece of text in
+   one of its fonts is in the same job, because a font can't be used by
+   two threads at once. */
+typedef struct _RasterJob
+{
+    RTF_Context *ctx;
+    RTF_Raster *rasters;
+    int numRasters;
+}
+RasterJob;
+
 /* static function prototypes */
 static int TwipsToPixels(int twips);
-static RTF_Surface *CreateSurface(RTF_Context *ctx,
+static int FindLayout(RTF_Context *ctx, int width);
+static void UseLayout(RTF_Context *ctx, int index);
+static int SDLCALL BackgroundReflow(void *data);
+static void FinishReflow(RTF_Context *ctx, bool wait);
+static RTF_Layout *NewLayout(RTF_Context *ctx);
+static bool LayoutText(RTF_Context *ctx, RTF_Layout *layout, int width,
+        bool lazy);
+static RTF_Layout *CreateLayout(RTF_Context *ctx, int width);
+static void ReleaseLayout(RTF_Context *ctx, RTF_Layout *layout);
+static void DestroyLayout(RTF_Context *ctx, RTF_Layout *layout);
+static void DropLineSurfaces(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_LineLayout *line);
+static void DropSurface(RTF_Context *ctx, RTF_Surface *surface);
+static void CompactSurfaces(RTF_Context *ctx, RTF_Layout *layout);
+static bool GrowLineLayouts(RTF_Context *ctx, RTF_Layout *layout);
+static void PositionLines(RTF_Context *ctx, RTF_Layout *layout, int first);
+static size_t LayoutMemory(RTF_Layout *layout);
+static void TrimLayouts(RTF_Context *ctx);
+static RTF_Surface *AddSurface(ReflowJob *job,
         RTF_TextBlock *textBlock, int offset, int numChars);
+static SDL_Texture *CreateSurface(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Surface *surface);
+static SDL_Texture *CacheSurface(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Surface *surface, SDL_Texture *texture, bool pooled);
+static bool GetSurfaceKey(RTF_Context *ctx, RTF_Surface *surface,
+        RTF_TextureKey *key);
+static SDL_Texture *ShareSurface(RTF_Context *ctx, RTF_Surface *surface);
+static void *CreateSurfaceText(RTF_Context *ctx, RTF_Surface *surface);
+static SDL_Color RenderColor(RTF_Context *ctx, RTF_Surface *surface);
+static void PrepareSurfaces(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset);
+static int SDLCALL CompareRasters(const void *a, const void *b);
+static void RasterizeSurfaces(RTF_Context *ctx, int numRasters);
+static void RasterizeText(void *data);
+static void RenderRaster(RTF_Context *ctx, RTF_Raster *raster);
+static SDL_Texture *UploadRaster(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Raster *raster);
+static void OffsetSurfaces(ReflowJob *job, int first, int offset);
 static int TextWithinWidth(RTF_TextBlock *textBlock, int offset,
         int width, int *wrapped);
-static int ReflowLine(RTF_Context *ctx, RTF_Line *line, int width);
-static void RenderLine(RTF_Context *ctx, RTF_Line *line, const SDL_Rect *rect, int yOffset);
+static int ReflowLine(ReflowJob *job, int index);
+static void ReflowLines(void *data);
+static void ReflowAllLines(RTF_Context *ctx, RTF_Layout *layout);
+static void BeginReflow(RTF_Context *ctx, RTF_Layout *layout, ReflowJob *job);
+static void EndReflow(RTF_Layout *layout, ReflowJob *job);
+static void MergeReflow(RTF_Context *ctx, RTF_Layout *layout, ReflowJob *job);
+static bool EstimateLine(RTF_Context *ctx, RTF_Layout *layout, int index);
+static int MeasureLine(RTF_Context *ctx, int index);
+static void ShiftLines(RTF_Context *ctx, int first, int offset);
+static void RefineLayout(RTF_Context *ctx);
+static void DropPages(RTF_Context *ctx);
+static void SetPageGeometry(RTF_Context *ctx);
+static bool FindPages(RTF_Context *ctx, RTF_Layout *layout);
+static int PageBreak(RTF_Layout *layout, RTF_LineLayout *line, int top,
+        int bottom);
+static void DropTiles(RTF_Context *ctx, RTF_Layout *layout, int y);
+static bool GrowTiles(RTF_Context *ctx, RTF_Layout *layout, int numTiles);
+static void MeasureLines(RTF_Context *ctx, int top, int bottom);
+static int RenderTiles(RTF_Context *ctx, const SDL_Rect *rect, int yOffset);
+static SDL_Texture *CreateTile(RTF_Context *ctx, RTF_Layout *layout,
+        int index);
+static void RenderLines(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset);
+static int TrackDamage(RTF_Context *ctx, const SDL_Rect *rect, int yOffset);
+static int RenderComposite(RTF_Context *ctx, const SDL_Rect *rect,
+        int yOffset);
+static SDL_Texture *GetComposite(RTF_Context *ctx, int index,
+        const SDL_Rect *rect);
+static SDL_Texture *CreateComposite(RTF_Context *ctx, int index,
+        const SDL_Rect *rect);
+static void DropComposites(RTF_Context *ctx);
+static void RenderView(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset);
+static void ClearTarget(SDL_Renderer *renderer);
+static void RenderLine(RTF_Context *ctx, RTF_Layout *layout, RTF_LineLayout *line, const SDL_Rect *rect, const SDL_Rect *clip, int yOffset);
+
+/*
+ * %%Function: RTF_malloc
+ */
+void *RTF_malloc(RTF_Context *ctx, size_t size)
+{
+    return ctx->allocator.malloc_func(ctx->allocator.userdata, size);
+}
+
+/*
+ * %%Function: RTF_realloc
+ */
+void *RTF_realloc(RTF_Context *ctx, void *mem, size_t size)
+{
+    return ctx->allocator.realloc_func(ctx->allocator.userdata, mem, size);
+}
+
+/*
+ * %%Function: RTF_free
+ */
+void RTF_free(RTF_Context *ctx, void *mem)
+{
+    ctx->allocator.free_func(ctx->allocator.userdata, mem);
+}
+
+/*
+ * %%Function: RTF_strdup
+ */
+char *RTF_strdup(RTF_Context *ctx, const char *string)
+{
+    size_t len = SDL_strlen(string) + 1;
+    char *copy = (char *) RTF_malloc(ctx, len);
+
+    if (copy)
+        SDL_memcpy(copy, string, len);
+    return copy;
+}
 
 /*
  * %%Function: RTF_CreateFont
@@ -40,8 +183,13 @@ static void RenderLine(RTF_Context *ctx, RTF_Line *line, const SDL_Rect *rect, i
 void *RTF_CreateFont(void *fontEngine, const char *name, int family,
         int charset, int size, int style)
 {
-    return ((RTF_FontEngine *) fontEngine)->CreateFont(name, family,
-            charset, size / 2, style);
+    RTF_FontEngine *engine = (RTF_FontEngine *) fontEngine;
+
+    /* The context's copy of the engine is zeroed past its version */
+    if (engine->CreateFontWithUserdata)
+        return engine->CreateFontWithUserdata(engine->userdata, name,
+                family, charset, size / 2, style);
+    return engine->CreateFont(name, family, charset, size / 2, style);
 }
 
 /*
@@ -53,34 +201,40 @@ void RTF_FreeFont(void *fontEngine, void *font)
 }
 
 /*
- * %%Function: RTF_FreeSurface
+ * %%Function: RTF_GetFontKey
+ *
+ * Identify a font by the engine instance that makes it and what it is made
+ * from, so the same font made by another context has the same key.  The
+ * functions that make the font are included, in case the memory of one
+ * engine is reused for another.
  */
-void RTF_FreeSurface(void *surface)
+Uint64 RTF_GetFontKey(void *fontEngine, const void *instance,
+        const char *name, int family, int charset, int size, int style)
 {
-    SDL_DestroyTexture((SDL_Texture *)surface);
-}
+    RTF_FontEngine *engine = (RTF_FontEngine *) fontEngine;
+    Uint64 key = RTF_HASH_INIT;
+    int values[4];
 
-/*
- * %%Function: RTF_CreateColor
- */
-void *RTF_CreateColor(int r, int g, int b)
-{
-    SDL_Color *color = (SDL_Color *) SDL_malloc(sizeof(*color));
-    if (!color)
-        return NULL;
-    color->r = r;
-    color->g = g;
-    color->b = b;
-    color->a = SDL_ALPHA_OPAQUE;
-    return color;
+    values[0] = family;
+    values[1] = charset;
+    values[2] = size;
+    values[3] = style;
+    key = RTF_HashBytes(key, &instance, sizeof(instance));
+    key = RTF_HashBytes(key, &engine->CreateFont, sizeof(engine->CreateFont));
+    key = RTF_HashBytes(key, &engine->CreateFontWithUserdata,
+            sizeof(engine->CreateFontWithUserdata));
+    key = RTF_HashBytes(key, &engine->userdata, sizeof(engine->userdata));
+    key = RTF_HashBytes(key, values, sizeof(values));
+    return RTF_HashBytes(key, name, SDL_strlen(name));
 }
 
 /*
- * %%Function: RTF_FreeColor
+ * %%Function: RTF_FreeSurface
  */
-void RTF_FreeColor(void *color)
+void RTF_FreeSurface(void *surface)
 {
-    SDL_free(color);
+    if (surface)
+        SDL_DestroyTexture((SDL_Texture *)surface);
 }
 
 /*
@@ -110,271 +264,2349 @@ int RTF_GetChar(void *stream, unsigned char *c)
     return SDL_ReadIO((SDL_IOStream *)stream, c, 1);
 }
 
+/*
+ * %%Function: RTF_ClearLayouts
+ *
+ * Throw away every layout of the text.  If keepMemory is true, the memory
+ * of one of them is kept for the next layout.
+ */
+void RTF_ClearLayouts(RTF_Context *ctx, bool keepMemory)
+{
+    FinishReflow(ctx, true);
+    DropPages(ctx);
+    while (ctx->numLayouts > 0)
+    {
+        ReleaseLayout(ctx, ctx->layouts[--ctx->numLayouts]);
+    }
+    ctx->layout = NULL;
+    ++ctx->layoutGeneration;
+
+    if (!keepMemory)
+    {
+        if (ctx->spareLayout)
+        {
+            DestroyLayout(ctx, ctx->spareLayout);
+            ctx->spareLayout = NULL;
+        }
+        RTF_free(ctx, ctx->layouts);
+        ctx->layouts = NULL;
+        ctx->maxLayouts = 0;
+        RTF_free(ctx, ctx->pages);
+        ctx->pages = NULL;
+        ctx->maxPages = 0;
+        RTF_free(ctx, ctx->rasters);
+        ctx->rasters = NULL;
+        ctx->maxRasters = 0;
+        DropComposites(ctx);
+    }
+}
+
 /*
  * %%Function: ecReflowText
  *
- * Reflow the text to a new width
+ * Reflow the text to a new width, waiting for the layout if it is being
+ * made in the background.  Recently used layouts are cached, so switching
+ * back to one of their widths doesn't reflow anything.
  */
 int ecReflowText(RTF_Context *ctx, int width)
 {
-    RTF_Line *line;
+    RTF_Layout *layout;
+    int i;
 
-    if (ctx->displayWidth == width)
+    ctx->requestedWidth = width;
+    if (ctx->layout && ctx->layout->width == width)
         return ecOK;
 
-    /* Reflow the text to the new width */
-    ctx->displayWidth = width;
-    ctx->displayHeight = 0;
-    for (line = ctx->start; line; line = line->next)
+    FinishReflow(ctx, true);
+    i = FindLayout(ctx, width);
+    if (i < 0)
     {
-        ctx->displayHeight += ReflowLine(ctx, line, width);
+        if (ecGrowArray(ctx, (void **)&ctx->layouts, &ctx->maxLayouts,
+                ctx->numLayouts, sizeof(*ctx->layouts)) != ecOK)
+            return ecStackOverflow;
+        layout = CreateLayout(ctx, width);
+        if (!layout)
+            return ecStackOverflow;
+        i = ctx->numLayouts++;
+        ctx->layouts[i] = layout;
     }
+    UseLayout(ctx, i);
     return ecOK;
 }
 
 /*
- * %%Function: ecReflowText
+ * %%Function: ecRequestReflow
  *
- * Render the text to a surface
+ * Reflow the text to a new width.  With background reflow, the new layout
+ * is made on another thread and the current one stays in use until it is
+ * ready.  There is nothing to show before the first layout, so that one is
+ * always made right away.
  */
-int ecRenderText(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+int ecRequestReflow(RTF_Context *ctx, int width)
 {
-    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
-    RTF_Line *line;
-    SDL_Rect savedRect;
+    RTF_Layout *layout;
+    int i;
 
-    ecReflowText(ctx, rect->w);
+    FinishReflow(ctx, false);
+    if (!ctx->backgroundReflow || !ctx->layout)
+        return ecReflowText(ctx, width);
 
-    SDL_GetRenderClipRect(renderer, &savedRect);
-    SDL_SetRenderClipRect(renderer, rect);
-    for (line = ctx->start; line && yOffset < rect->h; line = line->next)
+    ctx->requestedWidth = width;
+    if (ctx->layout->width == width)
+        return ecOK;
+
+    i = FindLayout(ctx, width);
+    if (i >= 0)
     {
-        if (yOffset + line->lineHeight > 0)
-            RenderLine(ctx, line, rect, yOffset);
-        yOffset += line->lineHeight;
+        UseLayout(ctx, i);
+        return ecOK;
     }
-    SDL_SetRenderClipRect(renderer, &savedRect);
 
+    /* Only one reflow runs at a time, the latest width requested is
+       reflowed after it is done. */
+    if (ctx->reflowThread)
+        return ecOK;
+
+    layout = NewLayout(ctx);
+    if (!layout)
+        return ecStackOverflow;
+    layout->width = width;
+    ctx->reflowLayout = layout;
+    SDL_SetAtomicInt(&ctx->reflowDone, 0);
+    ctx->reflowThread = SDL_CreateThread(BackgroundReflow, "RTF_Reflow",
+            ctx);
+    if (!ctx->reflowThread)
+    {
+        ctx->reflowLayout = NULL;
+        ReleaseLayout(ctx, layout);
+        return ecReflowText(ctx, width);
+    }
     return ecOK;
 }
 
-static int TwipsToPixels(int twips)
+/*
+ * %%Function: ecWaitForReflow
+ *
+ * Wait for any reflow in the background to finish, and start using its
+ * layout.  This needs to be done before changing anything it reads.
+ */
+void ecWaitForReflow(RTF_Context *ctx)
 {
-    /* twips are 1/20 of a pointsize, calculate pixels at 72 dpi */
-    return (((twips * 64 * 72 + (36 + 32 * 72)) / 72) / 20) / 64;
+    FinishReflow(ctx, true);
 }
 
-static RTF_Surface *CreateSurface(RTF_Context *ctx,
-        RTF_TextBlock *textBlock, int offset, int numChars)
+/*
+ * %%Function: ecAppendLayout
+ *
+ * Lay out lines added to the end of the document at the current width.
+ * The line before them may have had text added to it too, so it is laid
+ * out again.  Layouts at other widths and the pages are thrown away rather
+ * than being brought up to date.
+ */
+int ecAppendLayout(RTF_Context *ctx, int firstNewLine)
 {
-    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
-    RTF_Surface *surface = (RTF_Surface *) SDL_malloc(sizeof(*surface));
-    SDL_Color color;
+    RTF_Layout *layout = ctx->layout;
+    RTF_LineLayout *line;
+    ReflowJob job;
+    int first, i;
 
-    if (surface)
+    DropPages(ctx);
+    ++ctx->layoutGeneration;
+    if (!layout)
+        return ecOK;
+
+    while (ctx->numLayouts > 1)
     {
-        char *text = &textBlock->text[textBlock->byteOffsets[offset]];
-        char *end =
-            &textBlock->text[textBlock->byteOffsets[offset + numChars]];
-        char ch;
+        ReleaseLayout(ctx, ctx->layouts[--ctx->numLayouts]);
+    }
 
-        ch = *end;
-        *end = '\0';
-        if (textBlock->color)
-            color = *(SDL_Color *) textBlock->color;
-        else
-            SDL_memset(&color, 0, sizeof(color));
-        surface->surface = ((RTF_FontEngine *) ctx->fontEngine)->RenderText(textBlock->font, renderer, text, color);
-        *end = ch;
-        if (!surface->surface)
-        {
-            SDL_free(surface);
-            return (NULL);
-        }
-        surface->x = 0;
-        surface->y = 0;
-        surface->next = NULL;
+    if (!GrowLineLayouts(ctx, layout))
+    {
+        RTF_ClearLayouts(ctx, true);
+        return ecStackOverflow;
     }
-    return surface;
+
+    first = firstNewLine;
+    if (first > 0)
+    {
+        --first;
+        line = &layout->lines[first];
+        DropLineSurfaces(ctx, layout, line);
+        if (line->estimated)
+            --layout->numEstimated;
+    }
+    if (layout->refineLine > first)
+        layout->refineLine = first;
+
+    BeginReflow(ctx, layout, &job);
+    for (i = first; i < ctx->numLines; ++i)
+    {
+        if (!ctx->lazyLayout)
+            ReflowLine(&job, i);
+        else if (EstimateLine(ctx, layout, i))
+            ++layout->numEstimated;
+    }
+    EndReflow(layout, &job);
+
+    /* Everything after the first line laid out is new, so only these
+       lines need to be positioned */
+    PositionLines(ctx, layout, first);
+    return ecOK;
 }
 
-static int TextWithinWidth(RTF_TextBlock *textBlock, int offset,
-        int width, int *wrapped)
+/*
+ * %%Function: ecEditLayout
+ *
+ * Update the current layout after an edit replaced some lines.  Only the
+ * new lines are laid out, the lines after them keep their layout and are
+ * moved down or up.  Layouts at other widths and the pages are thrown
+ * away.
+ */
+int ecEditLayout(RTF_Context *ctx, const RTF_Edit *edit)
 {
-    int num = 0;
-    int wrapIndex;
+    RTF_Layout *layout = ctx->layout;
+    int oldEnd = edit->line + edit->numOld;
+    int newEnd = edit->line + edit->numNew;
+    ReflowJob job;
+    int i, j;
 
-    /* Fit as many characters as possible into the available width */
-    *wrapped = 0;
-    if (offset + num < textBlock->numChars)
+    /* Keep the text at the top of the view where it was */
+    if (ctx->anchorLine >= oldEnd)
     {
-        while ((textBlock->pixelOffsets[offset + num + 1] -
-                textBlock->pixelOffsets[offset]) <= width)
-        {
-            ++num;
-            if (offset + num == textBlock->numChars)
-                return num;
-        }
+        ctx->anchorLine += newEnd - oldEnd;
+    }
+    else if (ctx->anchorLine > edit->line)
+    {
+        ctx->anchorLine = edit->line;
+        ctx->anchorOffset = 0;
+        ctx->anchorHeight = 0;
+    }
 
-        /* Do word wrapping */
-        for (wrapIndex = offset + num - 1; wrapIndex > offset;
-             --wrapIndex)
-        {
-            if (SDL_isspace(
-                    textBlock->text[textBlock->byteOffsets[wrapIndex]]))
-                break;
-        }
-        if (wrapIndex > offset)
+    DropPages(ctx);
+    ++ctx->layoutGeneration;
+    if (!layout)
+        return ecOK;
+
+    while (ctx->numLayouts > 1)
+    {
+        ReleaseLayout(ctx, ctx->layouts[--ctx->numLayouts]);
+    }
+
+    for (i = edit->line; i < oldEnd; ++i)
+    {
+        DropLineSurfaces(ctx, layout, &layout->lines[i]);
+        if (layout->lines[i].estimated)
+            --layout->numEstimated;
+    }
+    if (!GrowLineLayouts(ctx, layout))
+    {
+        RTF_ClearLayouts(ctx, true);
+        return ecStackOverflow;
+    }
+    SDL_memmove(&layout->lines[newEnd], &layout->lines[oldEnd],
+            (ctx->numLines - newEnd) * sizeof(*layout->lines));
+
+    /* The text blocks of the lines after the edit have moved too */
+    if (edit->blockDelta)
+    {
+        for (i = newEnd; i < ctx->numLines; ++i)
         {
-            num = wrapIndex - offset + 1;
-            *wrapped = 1;
+            RTF_LineLayout *line = &layout->lines[i];
+
+            for (j = 0; j < line->numSurfaces; ++j)
+                layout->surfaces[line->surface + j].block += edit->blockDelta;
         }
     }
-    return num;
+
+    BeginReflow(ctx, layout, &job);
+    for (i = edit->line; i < newEnd; ++i)
+    {
+        if (!ctx->lazyLayout)
+            ReflowLine(&job, i);
+        else if (EstimateLine(ctx, layout, i))
+            ++layout->numEstimated;
+    }
+    EndReflow(layout, &job);
+    if (layout->refineLine > edit->line)
+        layout->refineLine = edit->line;
+
+    PositionLines(ctx, layout, edit->line);
+
+    /* Editing the same lines over and over leaves their old surfaces
+       behind, so every now and then get rid of them */
+    if (layout->droppedSurfaces > layout->numSurfaces / 2)
+        CompactSurfaces(ctx, layout);
+    return ecOK;
 }
 
-static int ReflowLine(RTF_Context *ctx, RTF_Line *line, int width)
+/*
+ * %%Function: ecReloadLayout
+ *
+ * Update the current layout after the document was reloaded.  Lines that
+ * match a line of the old document keep its layout and textures, the rest
+ * are laid out.  Layouts at other widths and the pages are thrown away.
+ */
+int ecReloadLayout(RTF_Context *ctx, const RTF_LineMatch *matches,
+        int numOldLines)
 {
-    while (line->startSurface)
+    RTF_Layout *layout = ctx->layout;
+    RTF_LineLayout *lines;
+    ReflowJob job;
+    int anchor = 0;
+    int next, i, j, k;
+
+    /* Keep the text at the top of the view where it was, or if that line
+       changed, go to the start of the text that replaced it */
+    for (j = 0; j < ctx->numLines; ++j)
     {
-        RTF_Surface *surface = line->startSurface;
-        line->startSurface = surface->next;
-        RTF_FreeSurface(surface->surface);
-        SDL_free(surface);
+        if (matches[j].line < 0)
+            continue;
+        if (matches[j].line >= ctx->anchorLine)
+            break;
+        anchor = j + 1;
     }
-    if (line->start)
+    if (j < ctx->numLines && matches[j].line == ctx->anchorLine)
     {
-        int leftMargin = TwipsToPixels(line->pap.xaLeft);
-        int rightMargin = TwipsToPixels(line->pap.xaRight);
-        int tabStop = TwipsToPixels(720);
-        RTF_TextBlock *textBlock;
-        RTF_Surface *surface;
-        RTF_Surface *rowStart = NULL;
-        int lineHeight = 0;
-        int lineWidth = TwipsToPixels(line->pap.xaFirst);
-
-        width -= leftMargin;
-        width -= rightMargin;
-        line->lineWidth = 0;
-        line->lineHeight = 0;
-        for (textBlock = line->start; textBlock;
-             textBlock = textBlock->next)
-        {
-            int num, wrapped, numChars = 0;
-            int tab;
+        ctx->anchorLine = j;
+    }
+    else
+    {
+        ctx->anchorLine = anchor;
+        ctx->anchorOffset = 0;
+        ctx->anchorHeight = 0;
+    }
 
-            for (tab = 0; tab < textBlock->tabs; ++tab)
-            {
-                int nextTab = (((leftMargin + lineWidth) / tabStop) +
-                        1) * tabStop;
-                lineWidth = (nextTab - leftMargin);
-            }
-            do
-            {
-                num = TextWithinWidth(textBlock, numChars,
-                        (width - lineWidth), &wrapped);
-                if (num > 0)
-                {
-                    surface = CreateSurface(ctx, textBlock, numChars,
-                            num);
-                    if (surface)
-                    {
-                        if (!rowStart)
-                        {
-                            rowStart = surface;
-                        }
-                        surface->x = leftMargin + lineWidth;
-                        surface->y = line->lineHeight;
-                        if (line->startSurface)
-                            line->lastSurface->next = surface;
-                        else
-                            line->startSurface = surface;
-                        line->lastSurface = surface;
-                    }
-                    if (lineHeight < textBlock->lineHeight)
-                        lineHeight = textBlock->lineHeight;
-                    lineWidth +=
-                            (textBlock->pixelOffsets[numChars + num] -
-                            textBlock->pixelOffsets[numChars]);
-                    numChars += num;
-                }
-                if (wrapped)
-                {
-                    if (lineWidth > line->lineWidth)
-                        line->lineWidth = lineWidth;
-                    line->lineHeight += lineHeight;
+    DropPages(ctx);
+    ++ctx->layoutGeneration;
+    if (!layout)
+        return ecOK;
 
-                    if (line->pap.just == justC)
-                    {
-                        int offset = (width - lineWidth) / 2;
+    while (ctx->numLayouts > 1)
+    {
+        ReleaseLayout(ctx, ctx->layouts[--ctx->numLayouts]);
+    }
 
-                        while (rowStart)
-                        {
-                            rowStart->x += offset;
-                            rowStart = rowStart->next;
-                        }
-                    }
-                    else if (line->pap.just == justR)
-                    {
-                        int offset = (leftMargin + width - lineWidth);
+    lines = (RTF_LineLayout *) RTF_malloc(ctx,
+            (ctx->numLines + 1) * sizeof(*lines));
+    if (!lines)
+    {
+        RTF_ClearLayouts(ctx, true);
+        return ecStackOverflow;
+    }
 
-                        while (rowStart)
-                        {
-                            rowStart->x += offset;
-                            rowStart = rowStart->next;
-                        }
-                    }
-                    rowStart = NULL;
+    /* Move the layout of each unchanged line to its new place, and drop
+       the textures of the lines in between */
+    next = 0;
+    for (j = 0; j < ctx->numLines; ++j)
+    {
+        RTF_LineLayout *line = &lines[j];
+        int blockDelta;
 
-                    lineWidth = 0;
-                    lineHeight = 0;
-                }
-            }
-            while (num > 0);
-        }
-        if (lineWidth > line->lineWidth)
+        i = matches[j].line;
+        if (i < 0)
+            continue;
+        for (; next < i; ++next)
         {
-            line->lineWidth = lineWidth;
+            DropLineSurfaces(ctx, layout, &layout->lines[next]);
+            if (layout->lines[next].estimated)
+                --layout->numEstimated;
         }
-        line->lineHeight += lineHeight;
+        next = i + 1;
 
-        if (line->pap.just == justC)
+        *line = layout->lines[i];
+        blockDelta = ctx->lines[j].block - matches[j].block;
+        if (blockDelta)
         {
-            int offset = (width - lineWidth) / 2;
-
-            while (rowStart)
-            {
-                rowStart->x += offset;
-                rowStart = rowStart->next;
-            }
+            for (k = 0; k < line->numSurfaces; ++k)
+                layout->surfaces[line->surface + k].block += blockDelta;
         }
-        else if (line->pap.just == justR)
-        {
-            int offset = (leftMargin + width - lineWidth);
+    }
+    for (; next < numOldLines; ++next)
+    {
+        DropLineSurfaces(ctx, layout, &layout->lines[next]);
+        if (layout->lines[next].estimated)
+            --layout->numEstimated;
+    }
+    RTF_free(ctx, layout->lines);
+    layout->lines = lines;
+    layout->maxLines = ctx->numLines + 1;
 
-            while (rowStart)
-            {
-                rowStart->x += offset;
-                rowStart = rowStart->next;
-            }
-        }
+    BeginReflow(ctx, layout, &job);
+    for (j = 0; j < ctx->numLines; ++j)
+    {
+        if (matches[j].line >= 0)
+            continue;
+        if (!ctx->lazyLayout)
+            ReflowLine(&job, j);
+        else if (EstimateLine(ctx, layout, j))
+            ++layout->numEstimated;
     }
-    return line->lineHeight;
+    EndReflow(layout, &job);
+    layout->refineLine = 0;
+
+    PositionLines(ctx, layout, 0);
+    if (layout->droppedSurfaces > layout->numSurfaces / 2)
+        CompactSurfaces(ctx, layout);
+    return ecOK;
 }
 
-static void RenderLine(RTF_Context *ctx, RTF_Line *line, const SDL_Rect *rect, int yOffset)
+/*
+ * %%Function: ecLineAtY
+ *
+ * Find the first line that extends below y in the current layout.
+ * Returns the number of lines if there is no such line.
+ */
+int ecLineAtY(RTF_Context *ctx, int y)
 {
-    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
-    SDL_FRect dstRect;
-    RTF_Surface *surface;
+    RTF_Layout *layout = ctx->layout;
+    int lo = 0;
+    int hi = ctx->numLines;
 
-    for (surface = line->startSurface; surface; surface = surface->next)
+    if (!layout)
+        return ctx->numLines;
+
+    while (lo < hi)
     {
-        SDL_Texture *texture = (SDL_Texture *)surface->surface;
+        int mid = lo + (hi - lo) / 2;
+        RTF_LineLayout *line = &layout->lines[mid];
 
-        dstRect.x = (float)(rect->x + surface->x);
-        dstRect.y = (float)(rect->y + yOffset + surface->y);
-        SDL_GetTextureSize(texture, &dstRect.w, &dstRect.h);
-        SDL_RenderTexture(renderer, texture, NULL, &dstRect);
+        if (line->y + line->lineHeight <= y)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * %%Function: ecAnchoredOffset
+ *
+ * Find where the text at the top of the last render is now, after the
+ * lines above it have been laid out or the text has been reflowed.
+ */
+int ecAnchoredOffset(RTF_Context *ctx)
+{
+    RTF_LineLayout *line;
+    int offset;
+
+    if (!ctx->layout || ctx->anchorLine >= ctx->numLines)
+        return 0;
+
+    line = &ctx->layout->lines[ctx->anchorLine];
+    offset = ctx->anchorOffset;
+    if (ctx->anchorHeight > 0 && ctx->anchorHeight != line->lineHeight)
+        offset = (int)((Sint64)offset * line->lineHeight / ctx->anchorHeight);
+    return line->y + offset;
+}
+
+/*
+ * %%Function: ecSetTileHeight
+ *
+ * Change the height of the tiles the text is drawn from, or stop using
+ * tiles with a height of 0.  Tiles already made are thrown away.
+ */
+void ecSetTileHeight(RTF_Context *ctx, int tileHeight)
+{
+    int i;
+
+    if (tileHeight == ctx->tileHeight)
+        return;
+    for (i = 0; i < ctx->numLayouts; ++i)
+    {
+        DropTiles(ctx, ctx->layouts[i], 0);
+    }
+    ctx->tileHeight = tileHeight;
+}
+
+/*
+ * %%Function: ecResetRenderTargets
+ *
+ * Throw away everything drawn into render targets, because the renderer
+ * lost their contents.  It is drawn again as it comes into view, and the
+ * next render draws the whole view as if it were the first.
+ */
+void ecResetRenderTargets(RTF_Context *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->numLayouts; ++i)
+    {
+        DropTiles(ctx, ctx->layouts[i], 0);
+    }
+    DropComposites(ctx);
+    ctx->rendered = false;
+}
+
+/*
+ * %%Function: ecSetTextureAtlas
+ *
+ * Pack text into atlas pages of the given size, or give each piece of
+ * text a texture of its own if the size is 0.  Text in the old pages is
+ * rendered again the next time it is drawn.
+ */
+int ecSetTextureAtlas(RTF_Context *ctx, int pageSize)
+{
+    RTF_Atlas *atlas = NULL;
+
+    if (pageSize == RTF_GetAtlasPageSize(ctx->atlas))
+        return ecOK;
+    if (pageSize > 0)
+    {
+        atlas = RTF_CreateAtlas(ctx, pageSize);
+        if (!atlas)
+            return ecStackOverflow;
+    }
+    RTF_DestroyAtlas(ctx, ctx->atlas);
+    ctx->atlas = atlas;
+    return ecOK;
+}
+
+/*
+ * %%Function: ecSetCompositeCache
+ */
+void ecSetCompositeCache(RTF_Context *ctx, bool enabled)
+{
+    if (!enabled)
+        DropComposites(ctx);
+    ctx->compositeCache = enabled;
+}
+
+/*
+ * %%Function: ecNeedsRender
+ *
+ * Find out whether rendering would draw anything different from the last
+ * render, or would do some work, like laying out more lines or picking up
+ * a layout made in the background.
+ */
+bool ecNeedsRender(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+{
+    if (!ctx->rendered || ctx->renderGeneration != ctx->layoutGeneration)
+        return true;
+    if (!SDL_RectsEqual(rect, &ctx->renderRect) ||
+            yOffset != ctx->renderOffset)
+        return true;
+    if (ctx->layout && ctx->layout->numEstimated)
+        return true;
+    if (ctx->reflowThread && SDL_GetAtomicInt(&ctx->reflowDone))
+        return true;
+    return false;
+}
+
+/*
+ * %%Function: ecRenderText
+ *
+ * Render the text to a surface
+ */
+int ecRenderText(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_Layout *layout;
+    RTF_LineLayout *line;
+    SDL_Rect savedRect;
+    int first, status;
+
+    status = ecRequestReflow(ctx, rect->w);
+    if (status != ecOK)
+        return status;
+    layout = ctx->layout;
+
+    RTF_BeginTextureFrame(ctx->textureCache);
+    SDL_GetRenderClipRect(renderer, &savedRect);
+    SDL_SetRenderClipRect(renderer, rect);
+    if (ctx->compositeCache)
+    {
+        first = RenderComposite(ctx, rect, yOffset);
+    }
+    else if (ctx->tileHeight > 0)
+    {
+        first = RenderTiles(ctx, rect, yOffset);
+        TrackDamage(ctx, rect, yOffset);
+    }
+    else
+    {
+        /* Lines are laid out for real before any are drawn, so the text
+           in view can be rendered all at once */
+        first = ecLineAtY(ctx, -yOffset);
+        MeasureLines(ctx, -yOffset, -yOffset + rect->h);
+        RenderLines(ctx, rect, rect, yOffset);
+        TrackDamage(ctx, rect, yOffset);
+    }
+    SDL_SetRenderClipRect(renderer, &savedRect);
+
+    /* Remember what is at the top, so it can be found again */
+    if (first < ctx->numLines)
+    {
+        line = &layout->lines[first];
+        ctx->anchorLine = first;
+        ctx->anchorOffset = -yOffset - line->y;
+        ctx->anchorHeight = line->lineHeight;
+    }
+
+    if (layout->numEstimated)
+        RefineLayout(ctx);
+
+    /* New textures count against the layout cache size */
+    TrimLayouts(ctx);
+
+    return ecOK;
+}
+
+/*
+ * %%Function: ecPaginate
+ *
+ * Lay out the text at the width of a page and find where each page
+ * starts, if that hasn't been done since the document last changed.
+ */
+int ecPaginate(RTF_Context *ctx)
+{
+    RTF_Layout *layout;
+
+    if (ctx->pageLayout)
+        return ecOK;
+
+    /* The reflow threads can only work on one layout at a time */
+    FinishReflow(ctx, true);
+
+    SetPageGeometry(ctx);
+    layout = NewLayout(ctx);
+    if (!layout)
+        return ecStackOverflow;
+    if (!LayoutText(ctx, layout, ctx->pageText.w, false) ||
+            !FindPages(ctx, layout))
+    {
+        DestroyLayout(ctx, layout);
+        return ecStackOverflow;
+    }
+    ctx->pageLayout = layout;
+    return ecOK;
+}
+
+/*
+ * %%Function: ecPageAtY
+ *
+ * Find the page with the text at a vertical position of the current
+ * layout.  A position part way into a line is taken to be the same part
+ * way into the line on the pages.
+ */
+int ecPageAtY(RTF_Context *ctx, int y)
+{
+    RTF_LineLayout *line;
+    RTF_LineLayout *pageLine;
+    int index = ecLineAtY(ctx, y);
+    int pageY, lo, hi;
+
+    if (index >= ctx->numLines)
+        return ctx->numPages - 1;
+
+    line = &ctx->layout->lines[index];
+    pageLine = &ctx->pageLayout->lines[index];
+    pageY = pageLine->y;
+    if (line->lineHeight > 0)
+        pageY += (int)((Sint64)(y - line->y) * pageLine->lineHeight /
+                line->lineHeight);
+
+    /* Find the last page that starts at or above it */
+    lo = 0;
+    hi = ctx->numPages - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+
+        if (ctx->pages[mid].y <= pageY)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/*
+ * %%Function: ecRenderPage
+ *
+ * Render the text of a page, with the top left corner of the paper at the
+ * top left of the rectangle.  The page index says where to start, so this
+ * doesn't depend on the pages before it.
+ */
+int ecRenderPage(RTF_Context *ctx, int page, const SDL_Rect *rect)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_Layout *layout = ctx->pageLayout;
+    RTF_Page *start = &ctx->pages[page];
+    SDL_Rect savedRect, textRect, clipRect;
+    int bottom = layout->height;
+    int i;
+
+    if (page + 1 < ctx->numPages)
+        bottom = ctx->pages[page + 1].y;
+
+    textRect.x = rect->x + ctx->pageText.x;
+    textRect.y = rect->y + ctx->pageText.y;
+    textRect.w = ctx->pageText.w;
+    textRect.h = bottom - start->y;
+    if (!SDL_GetRectIntersection(&textRect, rect, &clipRect))
+        return ecOK;
+
+    RTF_BeginTextureFrame(ctx->textureCache);
+    SDL_GetRenderClipRect(renderer, &savedRect);
+    SDL_SetRenderClipRect(renderer, &clipRect);
+    for (i = start->line; i < ctx->numLines; ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+
+        if (line->y >= bottom)
+            break;
+        RenderLine(ctx, layout, line, &textRect, &clipRect,
+                line->y - start->y);
+    }
+    if (ctx->atlas)
+        RTF_DrawAtlas(ctx->atlas, renderer);
+    SDL_SetRenderClipRect(renderer, &savedRect);
+    return ecOK;
+}
+
+static int TwipsToPixels(int twips)
+{
+    /* twips are 1/20 of a pointsize, calculate pixels at 72 dpi */
+    return (((twips * 64 * 72 + (36 + 32 * 72)) / 72) / 20) / 64;
+}
+
+static int FindLayout(RTF_Context *ctx, int width)
+{
+    int i;
+
+    for (i = 0; i < ctx->numLayouts; ++i)
+    {
+        if (ctx->layouts[i]->width == width)
+            return i;
+    }
+    return -1;
+}
+
+/* Make a cached layout the current, most recently used one */
+static void UseLayout(RTF_Context *ctx, int index)
+{
+    RTF_Layout *layout = ctx->layouts[index];
+
+    SDL_memmove(&ctx->layouts[1], &ctx->layouts[0],
+            index * sizeof(*ctx->layouts));
+    ctx->layouts[0] = layout;
+    ctx->layout = layout;
+    ++ctx->layoutGeneration;
+    TrimLayouts(ctx);
+}
+
+/*
+ * The reflow thread only reads the lines and text blocks of the document
+ * and writes to its own layout, which nothing else has a pointer to until
+ * it is done.  It is published by setting reflowDone, and the thread that
+ * rendered the old layout picks it up, so the old layout stays valid for as
+ * long as it is being drawn and is only freed once it drops out of the
+ * layout cache.
+ */
+static int SDLCALL BackgroundReflow(void *data)
+{
+    RTF_Context *ctx = (RTF_Context *)data;
+    RTF_Layout *layout = ctx->reflowLayout;
+    int width = layout->width;
+
+    if (!LayoutText(ctx, layout, width, ctx->lazyLayout))
+    {
+        DestroyLayout(ctx, layout);
+        layout = NULL;
+    }
+    ctx->reflowLayout = layout;
+    SDL_SetAtomicInt(&ctx->reflowDone, 1);
+
+    if (layout && ctx->layoutCallback)
+        ctx->layoutCallback(ctx->layoutCallbackData, ctx, width);
+    return 0;
+}
+
+/*
+ * Start using the layout made in the background, if it is done or if wait
+ * is true.  A failed reflow is tried again the next time it is requested.
+ */
+static void FinishReflow(RTF_Context *ctx, bool wait)
+{
+    RTF_Layout *layout;
+
+    if (!ctx->reflowThread)
+        return;
+    if (!wait && !SDL_GetAtomicInt(&ctx->reflowDone))
+        return;
+
+    SDL_WaitThread(ctx->reflowThread, NULL);
+    ctx->reflowThread = NULL;
+    layout = ctx->reflowLayout;
+    ctx->reflowLayout = NULL;
+    if (!layout)
+        return;
+
+    if (ecGrowArray(ctx, (void **)&ctx->layouts, &ctx->maxLayouts,
+            ctx->numLayouts, sizeof(*ctx->layouts)) != ecOK)
+    {
+        ReleaseLayout(ctx, layout);
+        return;
+    }
+    ctx->layouts[ctx->numLayouts] = layout;
+    UseLayout(ctx, ctx->numLayouts++);
+}
+
+/* Get an empty layout, reusing the memory of an old one if possible */
+static RTF_Layout *NewLayout(RTF_Context *ctx)
+{
+    RTF_Layout *layout = ctx->spareLayout;
+
+    if (layout)
+    {
+        ctx->spareLayout = NULL;
+    }
+    else
+    {
+        layout = (RTF_Layout *) RTF_malloc(ctx, sizeof(*layout));
+        if (!layout)
+            return NULL;
+        SDL_memset(layout, 0, sizeof(*layout));
+    }
+    return layout;
+}
+
+static RTF_Layout *CreateLayout(RTF_Context *ctx, int width)
+{
+    RTF_Layout *layout = NewLayout(ctx);
+
+    if (!layout)
+        return NULL;
+    if (!LayoutText(ctx, layout, width, ctx->lazyLayout))
+    {
+        DestroyLayout(ctx, layout);
+        return NULL;
+    }
+    return layout;
+}
+
+/*
+ * Lay out the text at a width.  This only reads the document, so it can
+ * run on the reflow thread.
+ */
+static bool LayoutText(RTF_Context *ctx, RTF_Layout *layout, int width,
+        bool lazy)
+{
+    int i;
+
+    if (layout->maxLines < ctx->numLines)
+    {
+        RTF_LineLayout *lines = (RTF_LineLayout *) RTF_realloc(ctx,
+                layout->lines, ctx->numLines * sizeof(*lines));
+        if (!lines)
+            return false;
+        layout->lines = lines;
+        layout->maxLines = ctx->numLines;
+    }
+
+    layout->width = width;
+    layout->height = 0;
+    layout->numSurfaces = 0;
+    layout->numEstimated = 0;
+    layout->refineLine = 0;
+    layout->textureBytes = 0;
+    layout->droppedSurfaces = 0;
+
+    /* With lazy layout, lines only get an estimated height here and are
+       laid out for real when they are rendered or refined. */
+    if (lazy)
+    {
+        for (i = 0; i < ctx->numLines; ++i)
+        {
+            if (EstimateLine(ctx, layout, i))
+                ++layout->numEstimated;
+        }
+    }
+    else
+    {
+        ReflowAllLines(ctx, layout);
+    }
+
+    PositionLines(ctx, layout, 0);
+    return true;
+}
+
+/* Free the textures of a layout and keep its memory, if nothing else is */
+static void ReleaseLayout(RTF_Context *ctx, RTF_Layout *layout)
+{
+    int i;
+
+    for (i = 0; i < layout->numSurfaces; ++i)
+    {
+        DropSurface(ctx, &layout->surfaces[i]);
+    }
+    DropTiles(ctx, layout, 0);
+    layout->numSurfaces = 0;
+    layout->textureBytes = 0;
+    layout->droppedSurfaces = 0;
+
+    if (ctx->spareLayout)
+        DestroyLayout(ctx, layout);
+    else
+        ctx->spareLayout = layout;
+}
+
+static void DestroyLayout(RTF_Context *ctx, RTF_Layout *layout)
+{
+    int i;
+
+    for (i = 0; i < layout->numSurfaces; ++i)
+    {
+        DropSurface(ctx, &layout->surfaces[i]);
+    }
+    DropTiles(ctx, layout, 0);
+    RTF_free(ctx, layout->tiles);
+    RTF_free(ctx, layout->surfaces);
+    RTF_free(ctx, layout->lines);
+    RTF_free(ctx, layout);
+}
+
+/*
+ * Free the textures of a line that is going to be laid out again.  Its
+ * surfaces are reused if they are the last ones in the layout.
+ */
+static void DropLineSurfaces(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_LineLayout *line)
+{
+    RTF_Surface *surface = &layout->surfaces[line->surface];
+    RTF_Surface *end = surface + line->numSurfaces;
+
+    DropTiles(ctx, layout, line->y);
+    for (; surface < end; ++surface)
+    {
+        DropSurface(ctx, surface);
+        surface->texture = -1;
+    }
+    if (line->surface + line->numSurfaces == layout->numSurfaces)
+        layout->numSurfaces = line->surface;
+    else
+        layout->droppedSurfaces += line->numSurfaces;
+    line->numSurfaces = 0;
+}
+
+/* Free the texture of a surface, or its room in an atlas page */
+static void DropSurface(RTF_Context *ctx, RTF_Surface *surface)
+{
+    if (surface->text)
+    {
+        ((RTF_FontEngine *) ctx->fontEngine)->DestroyText(surface->text);
+        surface->text = NULL;
+    }
+    else if (surface->atlasX < 0)
+        RTF_RemoveCachedTexture(ctx->textureCache, surface->texture,
+                surface->generation);
+    else if (ctx->atlas)
+        RTF_ReleaseAtlasSurface(ctx->atlas, surface->texture,
+                surface->generation, surface->w, surface->h);
+}
+
+/* Copy the surfaces that are still in use into a new array, in line order */
+static void CompactSurfaces(RTF_Context *ctx, RTF_Layout *layout)
+{
+    RTF_Surface *surfaces = NULL;
+    int numSurfaces = 0;
+    int i;
+
+    for (i = 0; i < ctx->numLines; ++i)
+    {
+        numSurfaces += layout->lines[i].numSurfaces;
+    }
+    if (numSurfaces)
+    {
+        surfaces = (RTF_Surface *) RTF_malloc(ctx,
+                numSurfaces * sizeof(*surfaces));
+        if (!surfaces)
+            return;
+    }
+
+    numSurfaces = 0;
+    for (i = 0; i < ctx->numLines; ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+
+        if (line->numSurfaces)
+            SDL_memcpy(&surfaces[numSurfaces],
+                    &layout->surfaces[line->surface],
+                    line->numSurfaces * sizeof(*surfaces));
+        line->surface = numSurfaces;
+        numSurfaces += line->numSurfaces;
+    }
+    RTF_free(ctx, layout->surfaces);
+    layout->surfaces = surfaces;
+    layout->numSurfaces = numSurfaces;
+    layout->maxSurfaces = numSurfaces;
+    layout->droppedSurfaces = 0;
+}
+
+/* Make room in a layout for every line of the document */
+static bool GrowLineLayouts(RTF_Context *ctx, RTF_Layout *layout)
+{
+    while (layout->maxLines < ctx->numLines)
+    {
+        if (ecGrowArray(ctx, (void **)&layout->lines, &layout->maxLines,
+                layout->maxLines, sizeof(*layout->lines)) != ecOK)
+            return false;
+    }
+    return true;
+}
+
+/* Place the lines from first on one after the other */
+static void PositionLines(RTF_Context *ctx, RTF_Layout *layout, int first)
+{
+    int i;
+
+    layout->height = 0;
+    if (first > 0)
+        layout->height = layout->lines[first - 1].y +
+                layout->lines[first - 1].lineHeight;
+    DropTiles(ctx, layout, layout->height);
+    for (i = first; i < ctx->numLines; ++i)
+    {
+        layout->lines[i].y = layout->height;
+        layout->height += layout->lines[i].lineHeight;
+    }
+}
+
+static size_t LayoutMemory(RTF_Layout *layout)
+{
+    return sizeof(*layout) +
+            layout->maxLines * sizeof(*layout->lines) +
+            layout->maxSurfaces * sizeof(*layout->surfaces) +
+            layout->maxTiles * sizeof(*layout->tiles) +
+            layout->textureBytes;
+}
+
+/*
+ * Drop the least recently used layouts until the cache is within its
+ * limits.  The current layout is always kept.
+ */
+static void TrimLayouts(RTF_Context *ctx)
+{
+    size_t total;
+    int keep;
+
+    if (ctx->numLayouts <= 1)
+        return;
+
+    total = LayoutMemory(ctx->layouts[0]);
+    for (keep = 1; keep < ctx->numLayouts; ++keep)
+    {
+        total += LayoutMemory(ctx->layouts[keep]);
+        if (keep >= ctx->layoutCacheCount || total > ctx->layoutCacheBytes)
+            break;
+    }
+    while (ctx->numLayouts > keep)
+    {
+        ReleaseLayout(ctx, ctx->layouts[--ctx->numLayouts]);
+    }
+}
+
+static RTF_Surface *AddSurface(ReflowJob *job,
+        RTF_TextBlock *textBlock, int offset, int numChars)
+{
+    RTF_Surface *surface;
+
+    if (ecGrowArray(job->ctx, (void **)&job->surfaces, &job->maxSurfaces,
+            job->numSurfaces, sizeof(*surface)) != ecOK)
+        return NULL;
+    surface = &job->surfaces[job->numSurfaces++];
+    surface->block = (int)(textBlock - job->ctx->blocks);
+    surface->offset = offset;
+    surface->numChars = numChars;
+    surface->x = 0;
+    surface->y = 0;
+    surface->w = textBlock->pixelOffsets[offset + numChars] -
+            textBlock->pixelOffsets[offset];
+    surface->h = textBlock->lineHeight;
+    surface->texture = -1;
+    surface->generation = 0;
+    surface->atlasX = -1;
+    surface->atlasY = -1;
+    surface->text = NULL;
+    surface->modulated = false;
+    return surface;
+}
+
+/* Render the text of a surface and put its texture in the cache */
+static SDL_Texture *CreateSurface(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Surface *surface)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_FontEngine *fontEngine = (RTF_FontEngine *) ctx->fontEngine;
+    RTF_TextBlock *textBlock = &ctx->blocks[surface->block];
+    char *text = &textBlock->text[textBlock->byteOffsets[surface->offset]];
+    char *end = &textBlock->text[textBlock->byteOffsets[surface->offset +
+            surface->numChars]];
+    SDL_Texture *texture;
+    float w, h;
+    char ch;
+
+    texture = ShareSurface(ctx, surface);
+    if (texture)
+        return texture;
+
+    if (!fontEngine->RenderText || ctx->atlas)
+    {
+        RTF_Raster raster;
+
+        raster.surface = surface;
+        raster.font = textBlock->font;
+        RenderRaster(ctx, &raster);
+        return UploadRaster(ctx, layout, &raster);
+    }
+
+    ch = *end;
+    *end = '\0';
+    texture = fontEngine->RenderText(textBlock->font, renderer, text,
+            RenderColor(ctx, surface));
+    *end = ch;
+    if (!texture)
+        return NULL;
+
+    /* Remember the real size, so it doesn't have to be asked for again */
+    if (SDL_GetTextureSize(texture, &w, &h))
+    {
+        surface->w = (int)w;
+        surface->h = (int)h;
+    }
+    return CacheSurface(ctx, layout, surface, texture, false);
+}
+
+/*
+ * Put the texture of a surface in the cache.  A pooled texture can be
+ * bigger than the text in it, and all of it counts.
+ */
+static SDL_Texture *CacheSurface(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Surface *surface, SDL_Texture *texture, bool pooled)
+{
+    size_t bytes = (size_t)surface->w * surface->h * 4;
+    RTF_TextureKey key;
+    float w, h;
+
+    if (SDL_GetTextureSize(texture, &w, &h))
+        bytes = (size_t)w * (size_t)h * 4;
+    surface->atlasX = -1;
+    surface->atlasY = -1;
+    if (GetSurfaceKey(ctx, surface, &key))
+        surface->texture = RTF_AddSharedTexture(ctx->textureCache, texture,
+                surface->w, surface->h, pooled, &key, &surface->generation);
+    else
+        surface->texture = RTF_AddCachedTexture(ctx->textureCache, texture,
+                bytes, pooled, &layout->textureBytes, &surface->generation);
+    if (surface->texture < 0)
+        return NULL;
+    return texture;
+}
+
+/*
+ * Work out what the texture of a surface is made from, once it's known
+ * whether it is rendered in white.  Returns false if the texture isn't
+ * shared, because its font can't be identified or because text drawn
+ * from an atlas is better off there, where it's drawn with its page.
+ */
+static bool GetSurfaceKey(RTF_Context *ctx, RTF_Surface *surface,
+        RTF_TextureKey *key)
+{
+    RTF_TextBlock *textBlock = &ctx->blocks[surface->block];
+    int start = textBlock->byteOffsets[surface->offset];
+    int end = textBlock->byteOffsets[surface->offset + surface->numChars];
+
+    if (ctx->atlas)
+        return false;
+    key->font = ecGetFontKey(ctx, textBlock->font);
+    if (!key->font)
+        return false;
+    key->color = textBlock->color;
+    if (surface->modulated)
+        key->color.r = key->color.g = key->color.b = key->color.a = 255;
+    key->text = &textBlock->text[start];
+    key->length = end - start;
+    return true;
+}
+
+/*
+ * Use the texture of the same text in the same font and color, if this
+ * or another context drawing with the same renderer has one already.
+ */
+static SDL_Texture *ShareSurface(RTF_Context *ctx, RTF_Surface *surface)
+{
+    RTF_TextureKey key;
+    SDL_Texture *texture;
+
+    surface->modulated = ctx->colorModulation;
+    if (!GetSurfaceKey(ctx, surface, &key))
+        return NULL;
+    texture = RTF_FindSharedTexture(ctx->textureCache, &key,
+            &surface->texture, &surface->generation, &surface->w,
+            &surface->h);
+    if (!texture)
+        return NULL;
+
+    surface->atlasX = -1;
+    surface->atlasY = -1;
+    return texture;
+}
+
+/* Have the font engine make the object that draws the text of a surface */
+static void *CreateSurfaceText(RTF_Context *ctx, RTF_Surface *surface)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_TextBlock *textBlock = &ctx->blocks[surface->block];
+    char *text = &textBlock->text[textBlock->byteOffsets[surface->offset]];
+    char *end = &textBlock->text[textBlock->byteOffsets[surface->offset +
+            surface->numChars]];
+    void *result;
+    char ch;
+
+    ch = *end;
+    *end = '\0';
+    result = ((RTF_FontEngine *) ctx->fontEngine)->CreateText(textBlock->font, renderer, text, textBlock->color);
+    *end = ch;
+    return result;
+}
+
+/*
+ * The color to render the text of a surface in.  With color modulation
+ * the text is rendered in white and colored when it's drawn, so the same
+ * text in different colors looks the same to the texture.
+ */
+static SDL_Color RenderColor(RTF_Context *ctx, RTF_Surface *surface)
+{
+    SDL_Color white = { 255, 255, 255, 255 };
+
+    surface->modulated = ctx->colorModulation;
+    if (surface->modulated)
+        return white;
+    return ctx->blocks[surface->block].color;
+}
+
+/*
+ * Render the text inside the clip rectangle that has no texture yet, so
+ * drawing the lines finds all of it there.  When the font engine can
+ * render to surfaces, that is done on the worker threads, and only the
+ * textures are made here.
+ */
+static void PrepareSurfaces(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset)
+{
+    RTF_Layout *layout = ctx->layout;
+    int numRasters = 0;
+    int i;
+
+    if (!((RTF_FontEngine *) ctx->fontEngine)->RenderTextSurface ||
+            ((RTF_FontEngine *) ctx->fontEngine)->CreateText)
+        return;
+
+    for (i = ecLineAtY(ctx, clip->y - rect->y - yOffset); i < ctx->numLines;
+            ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+        RTF_Surface *surface = &layout->surfaces[line->surface];
+        RTF_Surface *end = surface + line->numSurfaces;
+
+        if (rect->y + yOffset + line->y >= clip->y + clip->h)
+            break;
+        for (; surface < end; ++surface)
+        {
+            RTF_Raster *raster;
+            int x = rect->x + surface->x;
+            int y = rect->y + yOffset + line->y + surface->y;
+
+            if (y >= clip->y + clip->h)
+                break;
+            if (y + surface->h <= clip->y ||
+                    x >= clip->x + clip->w || x + surface->w <= clip->x)
+                continue;
+            if (RTF_IsTextureCached(ctx->textureCache, surface->texture,
+                    surface->generation) || ShareSurface(ctx, surface))
+                continue;
+
+            /* Out of memory, the rest is rendered as it is drawn */
+            if (ecGrowArray(ctx, (void **)&ctx->rasters, &ctx->maxRasters,
+                    numRasters, sizeof(*raster)) != ecOK)
+                break;
+            raster = &ctx->rasters[numRasters++];
+            raster->surface = surface;
+            raster->font = ctx->blocks[surface->block].font;
+            raster->pixels = NULL;
+        }
+    }
+    if (numRasters == 0)
+        return;
+
+    RasterizeSurfaces(ctx, numRasters);
+    for (i = 0; i < numRasters; ++i)
+    {
+        UploadRaster(ctx, layout, &ctx->rasters[i]);
+    }
+}
+
+static int SDLCALL CompareRasters(const void *a, const void *b)
+{
+    uintptr_t fontA = (uintptr_t)((const RTF_Raster *)a)->font;
+    uintptr_t fontB = (uintptr_t)((const RTF_Raster *)b)->font;
+
+    if (fontA != fontB)
+        return fontA < fontB ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Render the text waiting in the context to surfaces, splitting it by
+ * font between the worker threads if there are any to spare.
+ */
+static void RasterizeSurfaces(RTF_Context *ctx, int numRasters)
+{
+    RasterJob jobs[RTF_MAX_REFLOW_JOBS];
+    RTF_WorkerPool *workers = ctx->workers;
+    int numJobs, perJob, i;
+
+    /* The threads only work on one thing at a time, and a layout being
+       made in the background may be using them */
+    if (ctx->reflowThread)
+        workers = NULL;
+    numJobs = RTF_GetWorkerCount(workers) * 4;
+    numJobs = SDL_min(numJobs, numRasters);
+    numJobs = SDL_min(numJobs, RTF_MAX_REFLOW_JOBS);
+    if (!workers || numJobs <= 1)
+    {
+        jobs[0].ctx = ctx;
+        jobs[0].rasters = ctx->rasters;
+        jobs[0].numRasters = numRasters;
+        RasterizeText(&jobs[0]);
+        return;
+    }
+
+    /* Start a new job at the first change of font after each share */
+    SDL_qsort(ctx->rasters, numRasters, sizeof(*ctx->rasters),
+            CompareRasters);
+    perJob = (numRasters + numJobs - 1) / numJobs;
+    numJobs = 0;
+    for (i = 0; i < numRasters; ++i)
+    {
+        if (numJobs == 0 || (jobs[numJobs - 1].numRasters >= perJob &&
+                ctx->rasters[i].font != ctx->rasters[i - 1].font))
+        {
+            jobs[numJobs].ctx = ctx;
+            jobs[numJobs].rasters = &ctx->rasters[i];
+            jobs[numJobs].numRasters = 0;
+            ++numJobs;
+        }
+        ++jobs[numJobs - 1].numRasters;
+    }
+    RTF_RunJobs(workers, RasterizeText, jobs, numJobs, sizeof(*jobs));
+}
+
+static void RasterizeText(void *data)
+{
+    RasterJob *job = (RasterJob *)data;
+    int i;
+
+    for (i = 0; i < job->numRasters; ++i)
+    {
+        RenderRaster(job->ctx, &job->rasters[i]);
+    }
+}
+
+/*
+ * Render the text of a surface to pixels.  This can run on any thread, as
+ * long as no other thread is using the same font, which also keeps the
+ * text block from being terminated by two threads at once.
+ */
+static void RenderRaster(RTF_Context *ctx, RTF_Raster *raster)
+{
+    RTF_Surface *surface = raster->surface;
+    RTF_TextBlock *textBlock = &ctx->blocks[surface->block];
+    char *text = &textBlock->text[textBlock->byteOffsets[surface->offset]];
+    char *end = &textBlock->text[textBlock->byteOffsets[surface->offset +
+            surface->numChars]];
+    char ch;
+
+    ch = *end;
+    *end = '\0';
+    raster->pixels = ((RTF_FontEngine *) ctx->fontEngine)->RenderTextSurface(raster->font, text, RenderColor(ctx, surface));
+    *end = ch;
+}
+
+/*
+ * Make a texture from the pixels of a surface and put it in the cache.
+ * The texture comes from the pool, so text laid out again refills the
+ * textures of the text it replaces instead of making new ones.
+ */
+static SDL_Texture *UploadRaster(RTF_Context *ctx, RTF_Layout *layout,
+        RTF_Raster *raster)
+{
+    RTF_Surface *surface = raster->surface;
+    SDL_Texture *texture = NULL;
+    SDL_Point position;
+
+    if (!raster->pixels)
+        return NULL;
+    if (ctx->atlas)
+    {
+        texture = RTF_PackAtlasSurface(ctx, ctx->atlas, raster->pixels,
+                &surface->texture, &surface->generation, &position);
+        if (texture)
+        {
+            surface->w = raster->pixels->w;
+            surface->h = raster->pixels->h;
+            surface->atlasX = position.x;
+            surface->atlasY = position.y;
+            SDL_DestroySurface(raster->pixels);
+            raster->pixels = NULL;
+            return texture;
+        }
+    }
+
+    /* Text that doesn't go in the atlas gets a texture of its own, unless
+       the same text was just uploaded for another surface */
+    texture = ShareSurface(ctx, surface);
+    if (texture)
+    {
+        SDL_DestroySurface(raster->pixels);
+        raster->pixels = NULL;
+        return texture;
+    }
+    texture = RTF_UploadTexture(ctx->textureCache, raster->pixels);
+    if (texture)
+    {
+        surface->w = raster->pixels->w;
+        surface->h = raster->pixels->h;
+    }
+    SDL_DestroySurface(raster->pixels);
+    raster->pixels = NULL;
+    if (!texture)
+        return NULL;
+    return CacheSurface(ctx, layout, surface, texture, true);
+}
+
+static void OffsetSurfaces(ReflowJob *job, int first, int offset)
+{
+    int i;
+
+    for (i = first; i < job->numSurfaces; ++i)
+    {
+        job->surfaces[i].x += offset;
+    }
+}
+
+/*
+ * Find how many characters of a text block, starting at offset, fit in the
+ * width.  If they don't all fit, the text is wrapped after the last space
+ * that fits, if there is one, and wrapped is set.
+ */
+static int TextWithinWidth(RTF_TextBlock *textBlock, int offset,
+        int width, int *wrapped)
+{
+    const int *pixelOffsets = textBlock->pixelOffsets;
+    const int *breaks = textBlock->breaks;
+    int limit = pixelOffsets[offset] + width;
+    int lo, hi, fit;
+
+    *wrapped = 0;
+    if (offset >= textBlock->numChars)
+        return 0;
+
+    /* Fit as many characters as possible into the available width */
+    lo = offset;
+    hi = textBlock->numChars;
+    while (lo < hi)
+    {
+        int mid = hi - (hi - lo) / 2;
+
+        if (pixelOffsets[mid] <= limit)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    fit = lo;
+    if (fit == textBlock->numChars)
+        return fit - offset;
+
+    /* Do word wrapping */
+    lo = 0;
+    hi = textBlock->numBreaks;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+
+        if (breaks[mid] <= fit)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && breaks[lo - 1] > offset + 1)
+    {
+        *wrapped = 1;
+        return breaks[lo - 1] - offset;
+    }
+    return fit - offset;
+}
+
+static int ReflowLine(ReflowJob *job, int index)
+{
+    RTF_Line *line = &job->ctx->lines[index];
+    RTF_LineLayout *lineLayout = &job->layout->lines[index];
+    int width = job->width;
+
+    lineLayout->surface = job->numSurfaces;
+    lineLayout->numSurfaces = 0;
+    lineLayout->lineWidth = 0;
+    lineLayout->lineHeight = line->lineHeight;
+    lineLayout->estimated = false;
+    if (line->numBlocks)
+    {
+        int leftMargin = TwipsToPixels(line->pap.xaLeft);
+        int rightMargin = TwipsToPixels(line->pap.xaRight);
+        int tabStop = TwipsToPixels(720);
+        RTF_TextBlock *textBlock = &job->ctx->blocks[line->block];
+        RTF_TextBlock *lastBlock = textBlock + line->numBlocks;
+        RTF_Surface *surface;
+        int rowStart = job->numSurfaces;
+        int lineHeight = 0;
+        int lineWidth = TwipsToPixels(line->pap.xaFirst);
+
+        width -= leftMargin;
+        width -= rightMargin;
+        lineLayout->lineWidth = 0;
+        lineLayout->lineHeight = 0;
+        for (; textBlock < lastBlock; ++textBlock)
+        {
+            int num, wrapped, numChars = 0;
+            int tab;
+
+            for (tab = 0; tab < textBlock->tabs; ++tab)
+            {
+                int nextTab = (((leftMargin + lineWidth) / tabStop) +
+                        1) * tabStop;
+                lineWidth = (nextTab - leftMargin);
+            }
+            do
+            {
+                num = TextWithinWidth(textBlock, numChars,
+                        (width - lineWidth), &wrapped);
+                if (!wrapped && numChars + num < textBlock->numChars)
+                {
+                    /* There's nowhere to wrap the text within the width,
+                       so move it to a new row, or break the word if it
+                       is at the start of the row already */
+                    if (job->numSurfaces > rowStart)
+                        num = 0;
+                    else if (num == 0)
+                        num = 1;
+                    wrapped = 1;
+                }
+                if (num > 0)
+                {
+                    surface = AddSurface(job, textBlock, numChars, num);
+                    if (surface)
+                    {
+                        surface->x = leftMargin + lineWidth;
+                        surface->y = lineLayout->lineHeight;
+                    }
+                    if (lineHeight < textBlock->lineHeight)
+                        lineHeight = textBlock->lineHeight;
+                    lineWidth +=
+                            (textBlock->pixelOffsets[numChars + num] -
+                            textBlock->pixelOffsets[numChars]);
+                    numChars += num;
+                }
+                if (wrapped)
+                {
+                    if (lineWidth > lineLayout->lineWidth)
+                        lineLayout->lineWidth = lineWidth;
+                    lineLayout->lineHeight += lineHeight;
+
+                    if (line->pap.just == justC)
+                    {
+                        OffsetSurfaces(job, rowStart,
+                                (width - lineWidth) / 2);
+                    }
+                    else if (line->pap.just == justR)
+                    {
+                        OffsetSurfaces(job, rowStart,
+                                (leftMargin + width - lineWidth));
+                    }
+                    rowStart = job->numSurfaces;
+
+                    lineWidth = 0;
+                    lineHeight = 0;
+                }
+            }
+            while (numChars < textBlock->numChars);
+        }
+        if (lineWidth > lineLayout->lineWidth)
+        {
+            lineLayout->lineWidth = lineWidth;
+        }
+        lineLayout->lineHeight += lineHeight;
+
+        if (line->pap.just == justC)
+        {
+            OffsetSurfaces(job, rowStart, (width - lineWidth) / 2);
+        }
+        else if (line->pap.just == justR)
+        {
+            OffsetSurfaces(job, rowStart, (leftMargin + width - lineWidth));
+        }
+    }
+    lineLayout->numSurfaces = job->numSurfaces - lineLayout->surface;
+    return lineLayout->lineHeight;
+}
+
+static void ReflowLines(void *data)
+{
+    ReflowJob *job = (ReflowJob *)data;
+    int i;
+
+    for (i = 0; i < job->numLines; ++i)
+    {
+        ReflowLine(job, job->firstLine + i);
+    }
+}
+
+/*
+ * Reflow every line, splitting the lines between the worker threads if
+ * there are enough of them to be worth it.
+ */
+static void ReflowAllLines(RTF_Context *ctx, RTF_Layout *layout)
+{
+    ReflowJob jobs[RTF_MAX_REFLOW_JOBS];
+    int numJobs, i;
+
+    numJobs = RTF_GetWorkerCount(ctx->workers) * 4;
+    numJobs = SDL_min(numJobs, ctx->numLines / RTF_MIN_LINES_PER_JOB);
+    numJobs = SDL_min(numJobs, RTF_MAX_REFLOW_JOBS);
+    if (!ctx->workers || numJobs <= 1)
+    {
+        BeginReflow(ctx, layout, &jobs[0]);
+        jobs[0].numLines = ctx->numLines;
+        ReflowLines(&jobs[0]);
+        EndReflow(layout, &jobs[0]);
+        return;
+    }
+
+    for (i = 0; i < numJobs; ++i)
+    {
+        SDL_memset(&jobs[i], 0, sizeof(jobs[i]));
+        jobs[i].ctx = ctx;
+        jobs[i].layout = layout;
+        jobs[i].width = layout->width;
+        jobs[i].firstLine = (int)((Sint64)ctx->numLines * i / numJobs);
+        jobs[i].numLines = (int)((Sint64)ctx->numLines * (i + 1) / numJobs) -
+                jobs[i].firstLine;
+    }
+    RTF_RunJobs(ctx->workers, ReflowLines, jobs, numJobs, sizeof(*jobs));
+    for (i = 0; i < numJobs; ++i)
+    {
+        MergeReflow(ctx, layout, &jobs[i]);
+    }
+}
+
+/* Set up a job to reflow lines into the layout's own surface array */
+static void BeginReflow(RTF_Context *ctx, RTF_Layout *layout, ReflowJob *job)
+{
+    job->ctx = ctx;
+    job->layout = layout;
+    job->width = layout->width;
+    job->firstLine = 0;
+    job->numLines = 0;
+    job->surfaces = layout->surfaces;
+    job->numSurfaces = layout->numSurfaces;
+    job->maxSurfaces = layout->maxSurfaces;
+}
+
+static void EndReflow(RTF_Layout *layout, ReflowJob *job)
+{
+    layout->surfaces = job->surfaces;
+    layout->numSurfaces = job->numSurfaces;
+    layout->maxSurfaces = job->maxSurfaces;
+}
+
+/* Append the surfaces from a worker thread to the layout's surfaces */
+static void MergeReflow(RTF_Context *ctx, RTF_Layout *layout, ReflowJob *job)
+{
+    int total = layout->numSurfaces + job->numSurfaces;
+    int i;
+
+    while (layout->maxSurfaces < total)
+    {
+        if (ecGrowArray(ctx, (void **)&layout->surfaces,
+                &layout->maxSurfaces, layout->maxSurfaces,
+                sizeof(*layout->surfaces)) != ecOK)
+        {
+            /* Out of memory, the lines will show up empty */
+            for (i = 0; i < job->numLines; ++i)
+                layout->lines[job->firstLine + i].numSurfaces = 0;
+            RTF_free(ctx, job->surfaces);
+            return;
+        }
+    }
+
+    if (job->numSurfaces)
+    {
+        SDL_memcpy(&layout->surfaces[layout->numSurfaces], job->surfaces,
+                job->numSurfaces * sizeof(*job->surfaces));
+    }
+    for (i = 0; i < job->numLines; ++i)
+    {
+        layout->lines[job->firstLine + i].surface += layout->numSurfaces;
+    }
+    layout->numSurfaces = total;
+    RTF_free(ctx, job->surfaces);
+}
+
+/*
+ * Guess the height of a line from the total width of its text, without
+ * doing any word wrapping.  Returns true if the height is a guess, lines
+ * without any text get their exact height.
+ */
+static bool EstimateLine(RTF_Context *ctx, RTF_Layout *layout, int index)
+{
+    RTF_Line *line = &ctx->lines[index];
+    RTF_LineLayout *lineLayout = &layout->lines[index];
+    int tabStop = TwipsToPixels(720);
+    RTF_TextBlock *textBlock = &ctx->blocks[line->block];
+    RTF_TextBlock *lastBlock = textBlock + line->numBlocks;
+    int width = layout->width;
+    int textWidth = TwipsToPixels(line->pap.xaFirst);
+    int rowHeight = 0;
+    int rows;
+
+    lineLayout->surface = 0;
+    lineLayout->numSurfaces = 0;
+    if (!line->numBlocks)
+    {
+        lineLayout->lineWidth = 0;
+        lineLayout->lineHeight = line->lineHeight;
+        lineLayout->estimated = false;
+        return false;
+    }
+
+    width -= TwipsToPixels(line->pap.xaLeft);
+    width -= TwipsToPixels(line->pap.xaRight);
+    for (; textBlock < lastBlock; ++textBlock)
+    {
+        textWidth += textBlock->tabs * tabStop;
+        if (textBlock->numChars > 0)
+        {
+            textWidth += textBlock->pixelOffsets[textBlock->numChars];
+            if (rowHeight < textBlock->lineHeight)
+                rowHeight = textBlock->lineHeight;
+        }
+    }
+
+    rows = 1;
+    if (width > 0 && textWidth > width)
+        rows = (textWidth + width - 1) / width;
+
+    lineLayout->lineWidth = SDL_min(textWidth, width);
+    lineLayout->lineHeight = rows * rowHeight;
+    lineLayout->estimated = true;
+    return true;
+}
+
+/*
+ * Lay out a line of the current layout that only has an estimated height,
+ * returning how much its height changed.  The caller is responsible for
+ * moving the lines after it.
+ */
+static int MeasureLine(RTF_Context *ctx, int index)
+{
+    RTF_Layout *layout = ctx->layout;
+    int estimate = layout->lines[index].lineHeight;
+    ReflowJob job;
+
+    DropTiles(ctx, layout, layout->lines[index].y);
+    ++ctx->layoutGeneration;
+    BeginReflow(ctx, layout, &job);
+    ReflowLine(&job, index);
+    EndReflow(layout, &job);
+    --layout->numEstimated;
+    return layout->lines[index].lineHeight - estimate;
+}
+
+static void ShiftLines(RTF_Context *ctx, int first, int offset)
+{
+    RTF_Layout *layout = ctx->layout;
+    int i;
+
+    for (i = first; i < ctx->numLines; ++i)
+    {
+        layout->lines[i].y += offset;
+    }
+    layout->height += offset;
+}
+
+/*
+ * Lay out more of the lines that only have an estimated height, for as
+ * long as the time budget allows.  This runs after rendering, so lines
+ * above the view only move the text by the time of the next render, when
+ * the application can use the anchored offset to follow it.
+ */
+static void RefineLayout(RTF_Context *ctx)
+{
+    RTF_Layout *layout = ctx->layout;
+    Uint64 deadline = SDL_GetTicksNS() + RTF_REFINE_BUDGET_NS;
+    int shift = 0;
+    int i;
+
+    for (i = layout->refineLine; i < ctx->numLines; ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+
+        line->y += shift;
+        if (line->estimated)
+        {
+            shift += MeasureLine(ctx, i);
+            if (!layout->numEstimated || SDL_GetTicksNS() >= deadline)
+            {
+                ++i;
+                break;
+            }
+        }
+    }
+    layout->refineLine = i;
+    if (shift)
+        ShiftLines(ctx, i, shift);
+}
+
+/* Throw away the pages, because the document changed */
+static void DropPages(RTF_Context *ctx)
+{
+    if (ctx->pageLayout)
+    {
+        ReleaseLayout(ctx, ctx->pageLayout);
+        ctx->pageLayout = NULL;
+    }
+    ctx->numPages = 0;
+}
+
+/*
+ * Work out the size of the paper and where the text goes on it, from the
+ * document properties.  Anything the document doesn't set is taken from
+ * Letter paper with the default margins.
+ */
+static void SetPageGeometry(RTF_Context *ctx)
+{
+    DOP *dop = &ctx->dop;
+    int left, right, top, bottom;
+
+    ctx->pageWidth = TwipsToPixels(dop->xaPage > 0 ? dop->xaPage :
+            RTF_DEFAULT_PAGE_WIDTH);
+    ctx->pageHeight = TwipsToPixels(dop->yaPage > 0 ? dop->yaPage :
+            RTF_DEFAULT_PAGE_HEIGHT);
+    left = TwipsToPixels(dop->xaLeft > 0 ? dop->xaLeft :
+            RTF_DEFAULT_MARGIN_LEFT);
+    right = TwipsToPixels(dop->xaRight > 0 ? dop->xaRight :
+            RTF_DEFAULT_MARGIN_RIGHT);
+    top = TwipsToPixels(dop->yaTop > 0 ? dop->yaTop :
+            RTF_DEFAULT_MARGIN_TOP);
+    bottom = TwipsToPixels(dop->yaBottom > 0 ? dop->yaBottom :
+            RTF_DEFAULT_MARGIN_BOTTOM);
+
+    ctx->pageText.x = left;
+    ctx->pageText.y = top;
+    ctx->pageText.w = SDL_max(ctx->pageWidth - left - right, 1);
+    ctx->pageText.h = SDL_max(ctx->pageHeight - top - bottom, 1);
+}
+
+/*
+ * Find where each page starts in a layout at the page width.  There is
+ * always at least one page, even if it is empty.
+ */
+static bool FindPages(RTF_Context *ctx, RTF_Layout *layout)
+{
+    int top = 0;
+    int i = 0;
+
+    ctx->numPages = 0;
+    for (;;)
+    {
+        int bottom = top + ctx->pageText.h;
+        RTF_Page *page;
+
+        if (ecGrowArray(ctx, (void **)&ctx->pages, &ctx->maxPages,
+                ctx->numPages, sizeof(*page)) != ecOK)
+            return false;
+        page = &ctx->pages[ctx->numPages++];
+        page->line = i;
+        page->y = top;
+
+        while (i < ctx->numLines &&
+                layout->lines[i].y + layout->lines[i].lineHeight <= bottom)
+            ++i;
+        if (i == ctx->numLines)
+            break;
+        top = PageBreak(layout, &layout->lines[i], top, bottom);
+    }
+    return true;
+}
+
+/*
+ * Find where to end a page in a line that goes past its bottom.  The page
+ * ends before the last row of the line that starts on it, or before the
+ * line.  If there's no such place, because a single row is taller than a
+ * page, the row is cut at the bottom of the page.
+ */
+static int PageBreak(RTF_Layout *layout, RTF_LineLayout *line, int top,
+        int bottom)
+{
+    RTF_Surface *surface = &layout->surfaces[line->surface];
+    RTF_Surface *end = surface + line->numSurfaces;
+    int best = line->y;
+
+    for (; surface < end; ++surface)
+    {
+        int rowTop = line->y + surface->y;
+
+        if (rowTop > bottom)
+            break;
+        best = rowTop;
+    }
+    if (best <= top)
+        best = bottom;
+    return best;
+}
+
+/* Throw away the tiles from the one at y down, because their text moved */
+static void DropTiles(RTF_Context *ctx, RTF_Layout *layout, int y)
+{
+    int first;
+
+    if (layout->numTiles == 0)
+        return;
+
+    first = y > 0 ? y / ctx->tileHeight : 0;
+    while (layout->numTiles > first)
+    {
+        RTF_Tile *tile = &layout->tiles[--layout->numTiles];
+
+        RTF_RemoveCachedTexture(ctx->textureCache, tile->texture,
+                tile->generation);
+    }
+}
+
+static bool GrowTiles(RTF_Context *ctx, RTF_Layout *layout, int numTiles)
+{
+    while (layout->numTiles < numTiles)
+    {
+        if (ecGrowArray(ctx, (void **)&layout->tiles, &layout->maxTiles,
+                layout->numTiles, sizeof(*layout->tiles)) != ecOK)
+            return false;
+        layout->tiles[layout->numTiles].texture = -1;
+        layout->tiles[layout->numTiles].generation = 0;
+        ++layout->numTiles;
+    }
+    return true;
+}
+
+/* Lay out the lines from top to bottom that only have an estimated height */
+static void MeasureLines(RTF_Context *ctx, int top, int bottom)
+{
+    RTF_Layout *layout = ctx->layout;
+    int shift = 0;
+    int i;
+
+    for (i = ecLineAtY(ctx, top); i < ctx->numLines; ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+
+        if (line->y + shift >= bottom)
+            break;
+        line->y += shift;
+        if (line->estimated)
+            shift += MeasureLine(ctx, i);
+    }
+    if (shift)
+        ShiftLines(ctx, i, shift);
+}
+
+/*
+ * Draw the text from the tiles in view, making the ones that aren't there
+ * yet.  A tile isn't drawn again when the lines in it change height, so
+ * they are laid out for real first.  If a tile can't be made, its lines
+ * are drawn directly.  Returns the line at the top of the view.
+ */
+static int RenderTiles(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_Layout *layout = ctx->layout;
+    int tileHeight = ctx->tileHeight;
+    int first = SDL_max(-yOffset, 0) / tileHeight;
+    int last = (-yOffset + rect->h - 1) / tileHeight;
+    int i;
+
+    if (-yOffset + rect->h <= 0)
+        return ecLineAtY(ctx, -yOffset);
+
+    MeasureLines(ctx, first * tileHeight, (last + 1) * tileHeight);
+    for (i = first; i <= last && i * tileHeight < layout->height; ++i)
+    {
+        SDL_Texture *texture = NULL;
+        SDL_FRect dstRect;
+
+        if (GrowTiles(ctx, layout, i + 1))
+        {
+            texture = RTF_GetCachedTexture(ctx->textureCache,
+                    layout->tiles[i].texture, layout->tiles[i].generation);
+            if (!texture)
+                texture = CreateTile(ctx, layout, i);
+        }
+        if (!texture)
+        {
+            SDL_Rect tileRect, clipRect;
+
+            tileRect.x = rect->x;
+            tileRect.y = rect->y + yOffset + i * tileHeight;
+            tileRect.w = rect->w;
+            tileRect.h = tileHeight;
+            if (SDL_GetRectIntersection(&tileRect, rect, &clipRect))
+                RenderLines(ctx, rect, &clipRect, yOffset);
+            continue;
+        }
+        dstRect.x = (float)rect->x;
+        dstRect.y = (float)(rect->y + yOffset + i * tileHeight);
+        dstRect.w = (float)layout->width;
+        dstRect.h = (float)tileHeight;
+        SDL_RenderTexture(renderer, texture, NULL, &dstRect);
+    }
+    return ecLineAtY(ctx, -yOffset);
+}
+
+/*
+ * Work out which part of the rectangle changes from the last render to
+ * this one, and remember this one.  Returns how far the text scrolled down
+ * if that is all that changed, otherwise 0.
+ */
+static int TrackDamage(RTF_Context *ctx, const SDL_Rect *rect, int yOffset)
+{
+    SDL_Rect *damage = &ctx->damage;
+    int scroll = yOffset - ctx->renderOffset;
+
+    *damage = *rect;
+    if (!ctx->rendered || ctx->renderGeneration != ctx->layoutGeneration ||
+            !SDL_RectsEqual(rect, &ctx->renderRect) ||
+            scroll <= -rect->h || scroll >= rect->h)
+    {
+        scroll = 0;
+    }
+    else if (scroll == 0)
+    {
+        damage->w = 0;
+        damage->h = 0;
+    }
+    else if (scroll > 0)
+    {
+        damage->h = scroll;
+    }
+    else
+    {
+        damage->y = rect->y + rect->h + scroll;
+        damage->h = -scroll;
+    }
+
+    ctx->rendered = true;
+    ctx->renderRect = *rect;
+    ctx->renderOffset = yOffset;
+    ctx->renderGeneration = ctx->layoutGeneration;
+    return scroll;
+}
+
+/*
+ * Draw the text through a texture that keeps the last render, so only the
+ * part that changed is drawn again.  When scrolling, the rest is moved
+ * over from the last render into the other texture.  If there is no
+ * texture to draw into, the text is drawn directly, so the rectangle
+ * should be the clip rectangle.  Returns the line at the top of the view.
+ */
+static int RenderComposite(RTF_Context *ctx, const SDL_Rect *rect,
+        int yOffset)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    SDL_Texture *target = SDL_GetRenderTarget(renderer);
+    SDL_Texture *last, *texture;
+    SDL_Rect damage, viewRect, clipRect;
+    SDL_FRect dstRect;
+    int next = 1 - ctx->composite;
+    int scroll;
+
+    /* Lines coming into view are laid out first, so anything that moves
+       because of it is part of the damage */
+    MeasureLines(ctx, -yOffset, -yOffset + rect->h);
+    scroll = TrackDamage(ctx, rect, yOffset);
+    damage = ctx->damage;
+    last = GetComposite(ctx, ctx->composite, rect);
+    if (!last)
+    {
+        damage = *rect;
+        scroll = 0;
+    }
+
+    if (!SDL_RectEmpty(&damage))
+    {
+        texture = GetComposite(ctx, next, rect);
+        if (!texture)
+            texture = CreateComposite(ctx, next, rect);
+        if (!texture || !SDL_SetRenderTarget(renderer, texture))
+        {
+            RenderView(ctx, rect, rect, yOffset);
+            return ecLineAtY(ctx, -yOffset);
+        }
+
+        ClearTarget(renderer);
+        if (scroll)
+        {
+            dstRect.x = 0.0f;
+            dstRect.y = (float)scroll;
+            dstRect.w = (float)rect->w;
+            dstRect.h = (float)rect->h;
+            SDL_RenderTexture(renderer, last, NULL, &dstRect);
+        }
+        viewRect.x = 0;
+        viewRect.y = 0;
+        viewRect.w = rect->w;
+        viewRect.h = rect->h;
+        clipRect.x = damage.x - rect->x;
+        clipRect.y = damage.y - rect->y;
+        clipRect.w = damage.w;
+        clipRect.h = damage.h;
+        SDL_SetRenderClipRect(renderer, &clipRect);
+        RenderView(ctx, &viewRect, &clipRect, yOffset);
+        SDL_SetRenderClipRect(renderer, NULL);
+        SDL_SetRenderTarget(renderer, target);
+
+        ctx->composite = next;
+        last = texture;
+    }
+
+    dstRect.x = (float)rect->x;
+    dstRect.y = (float)rect->y;
+    dstRect.w = (float)rect->w;
+    dstRect.h = (float)rect->h;
+    SDL_RenderTexture(renderer, last, NULL, &dstRect);
+    return ecLineAtY(ctx, -yOffset);
+}
+
+/* Get a composite texture if it's still there and the size of the view */
+static SDL_Texture *GetComposite(RTF_Context *ctx, int index,
+        const SDL_Rect *rect)
+{
+    RTF_Tile *composite = &ctx->composites[index];
+    SDL_Texture *texture;
+    float w, h;
+
+    texture = RTF_GetCachedTexture(ctx->textureCache, composite->texture,
+            composite->generation);
+    if (texture && SDL_GetTextureSize(texture, &w, &h) &&
+            (int)w == rect->w && (int)h == rect->h)
+        return texture;
+
+    RTF_RemoveCachedTexture(ctx->textureCache, composite->texture,
+            composite->generation);
+    composite->texture = -1;
+    return NULL;
+}
+
+static SDL_Texture *CreateComposite(RTF_Context *ctx, int index,
+        const SDL_Rect *rect)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_Tile *composite = &ctx->composites[index];
+    SDL_Texture *texture;
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_TARGET, rect->w, rect->h);
+    if (!texture)
+        return NULL;
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+
+    composite->texture = RTF_AddCachedTexture(ctx->textureCache, texture,
+            (size_t)rect->w * rect->h * 4, false, &ctx->compositeBytes,
+            &composite->generation);
+    if (composite->texture < 0)
+        return NULL;
+    return texture;
+}
+
+static void DropComposites(RTF_Context *ctx)
+{
+    int i;
+
+    for (i = 0; i < (int)SDL_arraysize(ctx->composites); ++i)
+    {
+        RTF_RemoveCachedTexture(ctx->textureCache,
+                ctx->composites[i].texture, ctx->composites[i].generation);
+        ctx->composites[i].texture = -1;
+    }
+}
+
+/* Draw the text in view, from tiles if there are any */
+static void RenderView(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset)
+{
+    if (ctx->tileHeight > 0)
+        RenderTiles(ctx, rect, yOffset);
+    else
+        RenderLines(ctx, rect, clip, yOffset);
+}
+
+/*
+ * Clear the render target to transparent black.  Text blended onto it
+ * ends up with its color premultiplied by its alpha.
+ */
+static void ClearTarget(SDL_Renderer *renderer)
+{
+    Uint8 r, g, b, a;
+
+    SDL_GetRenderDrawColor(renderer, &r, &g, &b, &a);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderDrawColor(renderer, r, g, b, a);
+}
+
+/* Draw the lines of a tile into a new texture and put it in the cache */
+static SDL_Texture *CreateTile(RTF_Context *ctx, RTF_Layout *layout,
+        int index)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    SDL_Texture *target = SDL_GetRenderTarget(renderer);
+    SDL_Texture *texture;
+    RTF_Tile *tile;
+    SDL_Rect tileRect;
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_TARGET, layout->width, ctx->tileHeight);
+    if (!texture)
+        return NULL;
+    if (!SDL_SetRenderTarget(renderer, texture))
+    {
+        SDL_DestroyTexture(texture);
+        return NULL;
+    }
+
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+    ClearTarget(renderer);
+
+    tileRect.x = 0;
+    tileRect.y = 0;
+    tileRect.w = layout->width;
+    tileRect.h = ctx->tileHeight;
+    RenderLines(ctx, &tileRect, &tileRect, -index * ctx->tileHeight);
+    SDL_SetRenderTarget(renderer, target);
+
+    tile = &layout->tiles[index];
+    tile->texture = RTF_AddCachedTexture(ctx->textureCache, texture,
+            (size_t)layout->width * ctx->tileHeight * 4, false,
+            &layout->textureBytes, &tile->generation);
+    if (tile->texture < 0)
+        return NULL;
+    return texture;
+}
+
+/* Draw the lines of the current layout that are inside the clip rectangle */
+static void RenderLines(RTF_Context *ctx, const SDL_Rect *rect,
+        const SDL_Rect *clip, int yOffset)
+{
+    RTF_Layout *layout = ctx->layout;
+    int i;
+
+    PrepareSurfaces(ctx, rect, clip, yOffset);
+    for (i = ecLineAtY(ctx, clip->y - rect->y - yOffset); i < ctx->numLines;
+            ++i)
+    {
+        RTF_LineLayout *line = &layout->lines[i];
+
+        if (rect->y + yOffset + line->y >= clip->y + clip->h)
+            break;
+        RenderLine(ctx, layout, line, rect, clip, yOffset + line->y);
+    }
+    if (ctx->atlas)
+        RTF_DrawAtlas(ctx->atlas, (SDL_Renderer *)ctx->renderer);
+}
+
+static void RenderLine(RTF_Context *ctx, RTF_Layout *layout, RTF_LineLayout *line, const SDL_Rect *rect, const SDL_Rect *clip, int yOffset)
+{
+    SDL_Renderer *renderer = (SDL_Renderer *)ctx->renderer;
+    RTF_FontEngine *fontEngine = (RTF_FontEngine *) ctx->fontEngine;
+    SDL_FRect srcRect, dstRect;
+    SDL_Color white = { 255, 255, 255, 255 };
+    RTF_Surface *surface = &layout->surfaces[line->surface];
+    RTF_Surface *end = surface + line->numSurfaces;
+
+    /* The surfaces of a line are in row order, and each one knows its
+       size, so only the ones inside the clip rectangle are looked at */
+    for (; surface < end; ++surface)
+    {
+        SDL_Texture *texture;
+        SDL_Color color;
+        int x = rect->x + surface->x;
+        int y = rect->y + yOffset + surface->y;
+
+        if (y >= clip->y + clip->h)
+            break;
+        if (y + surface->h <= clip->y ||
+                x >= clip->x + clip->w || x + surface->w <= clip->x)
+            continue;
+
+        /* The font engine may draw the text without textures of ours */
+        if (fontEngine->CreateText)
+        {
+            if (!surface->text)
+                surface->text = CreateSurfaceText(ctx, surface);
+            if (surface->text)
+                fontEngine->DrawText(surface->text, renderer, (float)x,
+                        (float)y);
+            continue;
+        }
+
+        texture = RTF_GetCachedTexture(ctx->textureCache, surface->texture,
+                surface->generation);
+        if (!texture)
+        {
+            texture = CreateSurface(ctx, layout, surface);
+            if (!texture)
+                continue;
+        }
+        dstRect.x = (float)x;
+        dstRect.y = (float)y;
+        dstRect.w = (float)surface->w;
+        dstRect.h = (float)surface->h;
+        srcRect.w = dstRect.w;
+        srcRect.h = dstRect.h;
+        color = white;
+        if (surface->modulated)
+            color = ctx->blocks[surface->block].color;
+        if (surface->atlasX < 0)
+        {
+            /* A texture from the pool can be bigger than the text.  White
+               text that isn't modulated can share a texture with text that
+               is, so the texture is always given the color to draw in. */
+            srcRect.x = 0.0f;
+            srcRect.y = 0.0f;
+            SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+            SDL_SetTextureAlphaMod(texture, color.a);
+            SDL_RenderTexture(renderer, texture, &srcRect, &dstRect);
+            continue;
+        }
+
+        /* Text in an atlas page is drawn with the rest of the page */
+        srcRect.x = (float)surface->atlasX;
+        srcRect.y = (float)surface->atlasY;
+        if (RTF_QueueAtlasSurface(ctx, ctx->atlas, surface->texture,
+                texture, &srcRect, &dstRect, color))
+            continue;
+
+        /* The page is shared, so it's only colored for this piece */
+        SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+        SDL_SetTextureAlphaMod(texture, color.a);
+        SDL_RenderTexture(renderer, texture, &srcRect, &dstRect);
+        SDL_SetTextureColorMod(texture, 255, 255, 255);
+        SDL_SetTextureAlphaMod(texture, 255);
     }
 }
@@ -28,6 +28,22 @@
 #include <SDL3/SDL.h>
 
 int ecReflowText(RTF_Context *ctx, int width);
+int ecRequestReflow(RTF_Context *ctx, int width);
+void ecWaitForReflow(RTF_Context *ctx);
+int ecAppendLayout(RTF_Context *ctx, int firstNewLine);
+int ecEditLayout(RTF_Context *ctx, const RTF_Edit *edit);
+int ecReloadLayout(RTF_Context *ctx, const RTF_LineMatch *matches,
+        int numOldLines);
+int ecLineAtY(RTF_Context *ctx, int y);
+int ecAnchoredOffset(RTF_Context *ctx);
+void ecSetTileHeight(RTF_Context *ctx, int tileHeight);
+void ecResetRenderTargets(RTF_Context *ctx);
+int ecSetTextureAtlas(RTF_Context *ctx, int pageSize);
+void ecSetCompositeCache(RTF_Context *ctx, bool enabled);
+bool ecNeedsRender(RTF_Context *ctx, const SDL_Rect *rect, int yOffset);
 int ecRenderText(RTF_Context *ctx, const SDL_Rect *rect, int yOffset);
+int ecPaginate(RTF_Context *ctx);
+int ecPageAtY(RTF_Context *ctx, int y);
+int ecRenderPage(RTF_Context *ctx, int page, const SDL_Rect *rect);
 
 #endif /* _SDL_RTFREADR_H */
@@ -0,0 +1,892 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <SDL3_rtf/SDL_rtf.h>
+#include "SDL_rtftexture.h"
+
+#include "rtfdecl.h"
+
+/* How many renders per context a shared texture that nothing uses is
+   kept for, in case text laid out again uses it again */
+#define RTF_IDLE_TEXTURE_FRAMES 2
+
+/* Textures for text are made in a few sizes between each power of two,
+   from RTF_POOL_MIN_SIZE to RTF_POOL_MAX_SIZE, so one that other text is
+   done with fits new text about as big.  Text can use a texture up to
+   RTF_POOL_WIDER sizes wider and RTF_POOL_TALLER sizes taller than the
+   one it needs, which is at most twice as wide. */
+#define RTF_POOL_MIN_SIZE   16
+#define RTF_POOL_MAX_SIZE   4096
+#define RTF_POOL_STEPS      4
+#define RTF_POOL_SIZES      (1 + RTF_POOL_STEPS * 8)
+#define RTF_POOL_WIDER      RTF_POOL_STEPS
+#define RTF_POOL_TALLER     1
+
+/* A texture in the cache, or a free slot if texture is NULL */
+typedef struct _RTF_CachedTexture
+{
+    SDL_Texture *texture;
+    size_t bytes;
+    size_t *ownerBytes;         /* texture memory of the layout using it,
+                                   or NULL if the texture is shared */
+    Uint32 generation;          /* changes whenever the slot is freed */
+    Uint32 frame;               /* the render it was last drawn in */
+    int prev, next;             /* in the LRU list, or next free slot */
+
+    /* A shared texture is found by its key, which is kept here as the
+       font key, the color and the text, one after the other */
+    Uint64 hash;
+    char *key;                  /* NULL if the texture isn't shared */
+    size_t keySize;
+    int refCount;               /* surfaces using it */
+    int hashNext;               /* next shared texture in its bucket */
+
+    int w, h;                   /* of the text in its top left corner */
+    bool pooled;                /* made by RTF_UploadTexture() */
+}
+RTF_CachedTexture;
+
+/* A texture in the pool, or a free record if texture is NULL */
+typedef struct _RTF_PooledTexture
+{
+    SDL_Texture *texture;
+    size_t bytes;
+    Uint32 frame;               /* the render it was put in the pool in */
+    int next;                   /* in its bucket, or next free record */
+}
+RTF_PooledTexture;
+
+struct _RTF_TextureCache
+{
+    SDL_Renderer *renderer;
+    int refCount;
+    RTF_TextureCache *next;     /* in the list of all caches */
+
+    RTF_CachedTexture *slots;
+    int numSlots;
+    int maxSlots;
+    int freeSlot;               /* first free slot, or -1 */
+    int head;                   /* most recently drawn, or -1 */
+    int tail;                   /* least recently drawn, or -1 */
+
+    size_t maxBytes;            /* 0 for no limit */
+    RTF_TextureStats stats;
+    Uint32 frame;
+
+    int *buckets;               /* first shared texture with each hash */
+    int numBuckets;             /* a power of two */
+    int numShared;
+    int numIdle;                /* shared textures nothing uses */
+
+    /* Textures for text that nothing uses any more, kept for a few
+       renders to be filled with other text instead of making new ones */
+    RTF_PooledTexture *pool;
+    int numPool;
+    int maxPool;
+    int freePool;               /* first free record, or -1 */
+    int *poolBuckets;           /* first texture of each size, or -1 */
+    int numPooled;
+    size_t pooledBytes;
+};
+
+/* Every cache in use, one per renderer.  The lock only protects the list,
+   each cache is only used by the thread that draws with its renderer. */
+static RTF_TextureCache *textureCaches;
+static SDL_SpinLock textureCacheLock;
+
+/* static function prototypes */
+static void LinkSlot(RTF_TextureCache *cache, int slot);
+static void UnlinkSlot(RTF_TextureCache *cache, int slot);
+static void FreeSlot(RTF_TextureCache *cache, int slot);
+static void EvictTextures(RTF_TextureCache *cache);
+static void FreeIdleTextures(RTF_TextureCache *cache, bool all);
+static int NewSlot(RTF_TextureCache *cache);
+static Uint64 HashKey(const RTF_TextureKey *key);
+static bool MatchKey(const RTF_CachedTexture *entry, Uint64 hash,
+        const RTF_TextureKey *key);
+static bool GrowBuckets(RTF_TextureCache *cache);
+static void FreeTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        bool pooled);
+static size_t TextureBytes(SDL_Texture *texture, int w, int h);
+static int PoolSize(int size);
+static int PoolSizeToPixels(int poolSize);
+static SDL_Texture *TakePooledTexture(RTF_TextureCache *cache, int bucket);
+static void RecycleTexture(RTF_TextureCache *cache, SDL_Texture *texture);
+static void FreePooledTextures(RTF_TextureCache *cache, bool all);
+
+/*
+ * %%Function: RTF_AcquireTextureCache
+ *
+ * Get the texture cache shared by the contexts drawing with a renderer,
+ * creating it for the first one.  Each call needs a matching call to
+ * RTF_ReleaseTextureCache.
+ */
+RTF_TextureCache *RTF_AcquireTextureCache(SDL_Renderer *renderer)
+{
+    RTF_TextureCache *cache;
+
+    SDL_LockSpinlock(&textureCacheLock);
+    for (cache = textureCaches; cache; cache = cache->next)
+    {
+        if (cache->renderer == renderer)
+            break;
+    }
+    if (!cache)
+    {
+        cache = (RTF_TextureCache *) SDL_malloc(sizeof(*cache));
+        if (cache)
+        {
+            SDL_memset(cache, 0, sizeof(*cache));
+            cache->renderer = renderer;
+            cache->freeSlot = -1;
+            cache->head = -1;
+            cache->tail = -1;
+            cache->freePool = -1;
+            cache->next = textureCaches;
+            textureCaches = cache;
+        }
+    }
+    if (cache)
+        ++cache->refCount;
+    SDL_UnlockSpinlock(&textureCacheLock);
+    return cache;
+}
+
+/*
+ * %%Function: RTF_ReleaseTextureCache
+ *
+ * The last context to let go of a cache frees it.  By then its contexts
+ * have removed all their textures, and only shared textures nothing uses
+ * and the pooled ones are left.
+ */
+void RTF_ReleaseTextureCache(RTF_TextureCache *cache)
+{
+    RTF_TextureCache **prev;
+
+    if (!cache)
+        return;
+
+    SDL_LockSpinlock(&textureCacheLock);
+    if (--cache->refCount > 0)
+    {
+        SDL_UnlockSpinlock(&textureCacheLock);
+        return;
+    }
+    for (prev = &textureCaches; *prev != cache; prev = &(*prev)->next)
+        ;
+    *prev = cache->next;
+    SDL_UnlockSpinlock(&textureCacheLock);
+
+    FreeIdleTextures(cache, true);
+    FreePooledTextures(cache, true);
+    SDL_free(cache->buckets);
+    SDL_free(cache->slots);
+    SDL_free(cache->poolBuckets);
+    SDL_free(cache->pool);
+    SDL_free(cache);
+}
+
+/*
+ * %%Function: RTF_SetTextureCacheBudget
+ */
+void RTF_SetTextureCacheBudget(RTF_TextureCache *cache, size_t maxBytes)
+{
+    cache->maxBytes = maxBytes;
+    EvictTextures(cache);
+}
+
+/*
+ * %%Function: RTF_GetTextureCacheStats
+ */
+void RTF_GetTextureCacheStats(RTF_TextureCache *cache,
+        RTF_TextureStats *stats)
+{
+    *stats = cache->stats;
+    stats->numPooled = cache->numPooled;
+    stats->pooledBytes = cache->pooledBytes;
+}
+
+/*
+ * %%Function: RTF_BeginTextureFrame
+ *
+ * Start a render.  The textures drawn from now on aren't evicted until
+ * the next render starts, so the budget never takes away text that is on
+ * the screen.
+ */
+void RTF_BeginTextureFrame(RTF_TextureCache *cache)
+{
+    ++cache->frame;
+    FreeIdleTextures(cache, false);
+    FreePooledTextures(cache, false);
+}
+
+/*
+ * %%Function: RTF_GetCachedTexture
+ *
+ * Get the texture in a slot, counting it as drawn.  NULL means the text
+ * has to be rendered again, because it never was or because its texture
+ * was evicted and the slot reused.
+ */
+SDL_Texture *RTF_GetCachedTexture(RTF_TextureCache *cache, int slot,
+        Uint32 generation)
+{
+    RTF_CachedTexture *entry;
+
+    if (slot < 0 || slot >= cache->numSlots ||
+            cache->slots[slot].generation != generation ||
+            !cache->slots[slot].texture)
+        return NULL;
+
+    entry = &cache->slots[slot];
+    entry->frame = cache->frame;
+    if (cache->head != slot)
+    {
+        UnlinkSlot(cache, slot);
+        LinkSlot(cache, slot);
+    }
+    ++cache->stats.hits;
+    return entry->texture;
+}
+
+/*
+ * %%Function: RTF_IsTextureCached
+ *
+ * Find out if a slot still has its texture, without counting it as drawn.
+ */
+bool RTF_IsTextureCached(RTF_TextureCache *cache, int slot,
+        Uint32 generation)
+{
+    return slot >= 0 && slot < cache->numSlots &&
+            cache->slots[slot].generation == generation &&
+            cache->slots[slot].texture;
+}
+
+/*
+ * %%Function: RTF_AddCachedTexture
+ *
+ * Put a new texture in the cache, evicting older ones if that goes over
+ * the budget.  The texture's size is added to ownerBytes, and taken off
+ * again when it is removed or evicted.  A pooled texture, one made by
+ * RTF_UploadTexture, goes back in the pool then.  Returns the slot, with
+ * its generation in *generation, or -1 if out of memory, in which case
+ * the texture is freed.
+ */
+int RTF_AddCachedTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        size_t bytes, bool pooled, size_t *ownerBytes, Uint32 *generation)
+{
+    RTF_CachedTexture *entry;
+    int slot = NewSlot(cache);
+
+    if (slot < 0)
+    {
+        FreeTexture(cache, texture, pooled);
+        return -1;
+    }
+
+    entry = &cache->slots[slot];
+    entry->texture = texture;
+    entry->bytes = bytes;
+    entry->ownerBytes = ownerBytes;
+    entry->frame = cache->frame;
+    entry->key = NULL;
+    entry->pooled = pooled;
+    LinkSlot(cache, slot);
+    *ownerBytes += bytes;
+    cache->stats.misses++;
+    cache->stats.numTextures++;
+    cache->stats.textureBytes += bytes;
+
+    EvictTextures(cache);
+    *generation = entry->generation;
+    return slot;
+}
+
+/*
+ * %%Function: RTF_FindSharedTexture
+ *
+ * Look for a shared texture made from the same font, color and text, by
+ * this context or another one drawing with the same renderer.  Returns
+ * the texture, with its slot and generation and the size of the text in
+ * it, and counts it as drawn and as used once more, or NULL if there is
+ * none.
+ */
+SDL_Texture *RTF_FindSharedTexture(RTF_TextureCache *cache,
+        const RTF_TextureKey *key, int *slot, Uint32 *generation,
+        int *w, int *h)
+{
+    Uint64 hash;
+    int found;
+
+    if (cache->numShared == 0)
+        return NULL;
+
+    hash = HashKey(key);
+    found = cache->buckets[hash & (cache->numBuckets - 1)];
+    while (found >= 0 && !MatchKey(&cache->slots[found], hash, key))
+    {
+        found = cache->slots[found].hashNext;
+    }
+    if (found < 0)
+        return NULL;
+
+    if (cache->slots[found].refCount++ == 0)
+        --cache->numIdle;
+    *slot = found;
+    *generation = cache->slots[found].generation;
+    *w = cache->slots[found].w;
+    *h = cache->slots[found].h;
+    return RTF_GetCachedTexture(cache, found, *generation);
+}
+
+/*
+ * %%Function: RTF_AddSharedTexture
+ *
+ * Put a new texture in the cache that other text with the same key can
+ * use, used once so far, with the text w by h pixels in its top left
+ * corner.  Shared textures aren't counted as the memory of any one
+ * layout.  Returns the slot like RTF_AddCachedTexture.
+ */
+int RTF_AddSharedTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        int w, int h, bool pooled, const RTF_TextureKey *key,
+        Uint32 *generation)
+{
+    RTF_CachedTexture *entry;
+    size_t bytes = TextureBytes(texture, w, h);
+    size_t keySize = sizeof(key->font) + sizeof(key->color) + key->length;
+    char *copy;
+    int bucket, slot;
+
+    copy = (char *) SDL_malloc(keySize);
+    if (!copy || !GrowBuckets(cache))
+    {
+        SDL_free(copy);
+        FreeTexture(cache, texture, pooled);
+        return -1;
+    }
+    slot = NewSlot(cache);
+    if (slot < 0)
+    {
+        SDL_free(copy);
+        FreeTexture(cache, texture, pooled);
+        return -1;
+    }
+    SDL_memcpy(copy, &key->font, sizeof(key->font));
+    SDL_memcpy(copy + sizeof(key->font), &key->color, sizeof(key->color));
+    SDL_memcpy(copy + sizeof(key->font) + sizeof(key->color), key->text,
+            key->length);
+
+    entry = &cache->slots[slot];
+    entry->texture = texture;
+    entry->bytes = bytes;
+    entry->ownerBytes = NULL;
+    entry->frame = cache->frame;
+    entry->hash = HashKey(key);
+    entry->key = copy;
+    entry->keySize = keySize;
+    entry->refCount = 1;
+    entry->w = w;
+    entry->h = h;
+    entry->pooled = pooled;
+    bucket = (int)(entry->hash & (cache->numBuckets - 1));
+    entry->hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = slot;
+    ++cache->numShared;
+    LinkSlot(cache, slot);
+    cache->stats.misses++;
+    cache->stats.numTextures++;
+    cache->stats.textureBytes += bytes;
+
+    EvictTextures(cache);
+    *generation = entry->generation;
+    return slot;
+}
+
+/*
+ * %%Function: RTF_RemoveCachedTexture
+ *
+ * Free the texture in a slot, if it hasn't already been evicted.  A
+ * shared texture is only used once less, and is kept for a few renders
+ * after nothing uses it.
+ */
+void RTF_RemoveCachedTexture(RTF_TextureCache *cache, int slot,
+        Uint32 generation)
+{
+    RTF_CachedTexture *entry;
+
+    if (slot < 0 || slot >= cache->numSlots ||
+            cache->slots[slot].generation != generation ||
+            !cache->slots[slot].texture)
+        return;
+
+    entry = &cache->slots[slot];
+    if (!entry->key)
+    {
+        FreeSlot(cache, slot);
+        return;
+    }
+    if (--entry->refCount == 0)
+    {
+        entry->frame = cache->frame;
+        ++cache->numIdle;
+    }
+}
+
+/*
+ * %%Function: RTF_UploadTexture
+ *
+ * Make a texture with the pixels of some text in its top left corner.  A
+ * texture from the pool that is big enough is filled if there is one,
+ * otherwise a new one is made in the next pool size up, so it can go in
+ * the pool when the text is done with it.  The texture has to be put in
+ * the cache as pooled.  Returns NULL if it couldn't be made.
+ */
+SDL_Texture *RTF_UploadTexture(RTF_TextureCache *cache, SDL_Surface *pixels)
+{
+    SDL_Surface *converted = NULL;
+    SDL_Texture *texture = NULL;
+    SDL_Rect rect;
+    int w = PoolSize(pixels->w);
+    int h = PoolSize(pixels->h);
+    int width, height;
+
+    if (pixels->format != SDL_PIXELFORMAT_ARGB8888)
+    {
+        converted = SDL_ConvertSurface(pixels, SDL_PIXELFORMAT_ARGB8888);
+        if (!converted)
+            return NULL;
+        pixels = converted;
+    }
+
+    for (height = h; h >= 0 && height <= h + RTF_POOL_TALLER &&
+            height < RTF_POOL_SIZES && !texture; ++height)
+    {
+        for (width = w; w >= 0 && width <= w + RTF_POOL_WIDER &&
+                width < RTF_POOL_SIZES && !texture; ++width)
+        {
+            texture = TakePooledTexture(cache,
+                    height * RTF_POOL_SIZES + width);
+        }
+    }
+    if (texture)
+    {
+        /* The text drawn from it before may have colored it */
+        SDL_SetTextureColorMod(texture, 255, 255, 255);
+        SDL_SetTextureAlphaMod(texture, 255);
+        ++cache->stats.recycled;
+    }
+    else
+    {
+        /* Text too big for the pool gets a texture of its own size, which
+           is freed when the text is done with it */
+        texture = SDL_CreateTexture(cache->renderer,
+                SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                w >= 0 ? PoolSizeToPixels(w) : pixels->w,
+                h >= 0 ? PoolSizeToPixels(h) : pixels->h);
+        if (texture)
+        {
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+            SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+        }
+    }
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = pixels->w;
+    rect.h = pixels->h;
+    if (texture && !SDL_UpdateTexture(texture, &rect, pixels->pixels,
+            pixels->pitch))
+    {
+        RTF_FreeSurface(texture);
+        texture = NULL;
+    }
+    SDL_DestroySurface(converted);
+    return texture;
+}
+
+/* Take a slot off the free list, or add one.  Returns -1 if out of memory */
+static int NewSlot(RTF_TextureCache *cache)
+{
+    int slot = cache->freeSlot;
+
+    if (slot >= 0)
+    {
+        cache->freeSlot = cache->slots[slot].next;
+        return slot;
+    }
+    if (cache->numSlots == cache->maxSlots)
+    {
+        int maxSlots = cache->maxSlots ? cache->maxSlots * 2 : 64;
+        RTF_CachedTexture *slots = (RTF_CachedTexture *) SDL_realloc(
+                cache->slots, maxSlots * sizeof(*slots));
+
+        if (!slots)
+            return -1;
+        cache->slots = slots;
+        cache->maxSlots = maxSlots;
+    }
+    slot = cache->numSlots++;
+    cache->slots[slot].generation = 0;
+    return slot;
+}
+
+static Uint64 HashKey(const RTF_TextureKey *key)
+{
+    Uint64 hash = RTF_HASH_INIT;
+
+    hash = RTF_HashBytes(hash, &key->font, sizeof(key->font));
+    hash = RTF_HashBytes(hash, &key->color, sizeof(key->color));
+    return RTF_HashBytes(hash, key->text, key->length);
+}
+
+static bool MatchKey(const RTF_CachedTexture *entry, Uint64 hash,
+        const RTF_TextureKey *key)
+{
+    const char *text = entry->key + sizeof(key->font) + sizeof(key->color);
+
+    return entry->hash == hash &&
+            entry->keySize == sizeof(key->font) + sizeof(key->color) +
+                    key->length &&
+            SDL_memcmp(entry->key, &key->font, sizeof(key->font)) == 0 &&
+            SDL_memcmp(entry->key + sizeof(key->font), &key->color,
+                    sizeof(key->color)) == 0 &&
+            SDL_memcmp(text, key->text, key->length) == 0;
+}
+
+/* Make room for one more shared texture, keeping a bucket for each */
+static bool GrowBuckets(RTF_TextureCache *cache)
+{
+    int numBuckets, *buckets;
+    int i;
+
+    if (cache->numShared < cache->numBuckets)
+        return true;
+
+    numBuckets = cache->numBuckets ? cache->numBuckets * 2 : 64;
+    buckets = (int *) SDL_malloc(numBuckets * sizeof(*buckets));
+    if (!buckets)
+        return false;
+    for (i = 0; i < numBuckets; ++i)
+    {
+        buckets[i] = -1;
+    }
+    for (i = 0; i < cache->numSlots; ++i)
+    {
+        RTF_CachedTexture *entry = &cache->slots[i];
+        int bucket;
+
+        if (!entry->texture || !entry->key)
+            continue;
+        bucket = (int)(entry->hash & (numBuckets - 1));
+        entry->hashNext = buckets[bucket];
+        buckets[bucket] = i;
+    }
+    SDL_free(cache->buckets);
+    cache->buckets = buckets;
+    cache->numBuckets = numBuckets;
+    return true;
+}
+
+/* Free a texture that was in the cache, or put it back in the pool */
+static void FreeTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        bool pooled)
+{
+    if (pooled)
+        RecycleTexture(cache, texture);
+    else
+        RTF_FreeSurface(texture);
+}
+
+/* The memory a texture takes, which can be more than the text in it */
+static size_t TextureBytes(SDL_Texture *texture, int w, int h)
+{
+    float textureW, textureH;
+
+    if (SDL_GetTextureSize(texture, &textureW, &textureH))
+        return (size_t)textureW * (size_t)textureH * 4;
+    return (size_t)w * h * 4;
+}
+
+/* The smallest pool size at least size pixels big, or -1 if there is none */
+static int PoolSize(int size)
+{
+    int base = RTF_POOL_MIN_SIZE;
+    int poolSize = 0;
+    int step;
+
+    if (size <= RTF_POOL_MIN_SIZE)
+        return 0;
+    if (size > RTF_POOL_MAX_SIZE)
+        return -1;
+    while (size > base * 2)
+    {
+        base *= 2;
+        poolSize += RTF_POOL_STEPS;
+    }
+    step = base / RTF_POOL_STEPS;
+    return poolSize + (size - base + step - 1) / step;
+}
+
+static int PoolSizeToPixels(int poolSize)
+{
+    int base;
+
+    if (poolSize == 0)
+        return RTF_POOL_MIN_SIZE;
+    base = RTF_POOL_MIN_SIZE << ((poolSize - 1) / RTF_POOL_STEPS);
+    return base + ((poolSize - 1) % RTF_POOL_STEPS + 1) *
+            (base / RTF_POOL_STEPS);
+}
+
+/* Take the texture put in a pool bucket last, if there is one */
+static SDL_Texture *TakePooledTexture(RTF_TextureCache *cache, int bucket)
+{
+    RTF_PooledTexture *pooled;
+    SDL_Texture *texture;
+    int record;
+
+    if (cache->numPooled == 0 || cache->poolBuckets[bucket] < 0)
+        return NULL;
+
+    record = cache->poolBuckets[bucket];
+    pooled = &cache->pool[record];
+    texture = pooled->texture;
+    cache->poolBuckets[bucket] = pooled->next;
+    cache->pooledBytes -= pooled->bytes;
+    --cache->numPooled;
+
+    pooled->texture = NULL;
+    pooled->next = cache->freePool;
+    cache->freePool = record;
+    return texture;
+}
+
+/*
+ * Put a texture made by RTF_UploadTexture in the pool, unless it isn't
+ * one of the pool sizes or keeping it would go over the budget.
+ */
+static void RecycleTexture(RTF_TextureCache *cache, SDL_Texture *texture)
+{
+    RTF_PooledTexture *pooled;
+    float textureW, textureH;
+    int w, h, bucket, record, i;
+    size_t bytes;
+
+    if (!SDL_GetTextureSize(texture, &textureW, &textureH))
+    {
+        RTF_FreeSurface(texture);
+        return;
+    }
+    w = PoolSize((int)textureW);
+    h = PoolSize((int)textureH);
+    bytes = (size_t)textureW * (size_t)textureH * 4;
+    if (w < 0 || h < 0 || PoolSizeToPixels(w) != (int)textureW ||
+            PoolSizeToPixels(h) != (int)textureH || (cache->maxBytes &&
+            cache->stats.textureBytes + cache->pooledBytes + bytes >
+                    cache->maxBytes))
+    {
+        RTF_FreeSurface(texture);
+        return;
+    }
+
+    if (!cache->poolBuckets)
+    {
+        cache->poolBuckets = (int *) SDL_malloc(
+                RTF_POOL_SIZES * RTF_POOL_SIZES * sizeof(int));
+        if (!cache->poolBuckets)
+        {
+            RTF_FreeSurface(texture);
+            return;
+        }
+        for (i = 0; i < RTF_POOL_SIZES * RTF_POOL_SIZES; ++i)
+        {
+            cache->poolBuckets[i] = -1;
+        }
+    }
+    record = cache->freePool;
+    if (record >= 0)
+        cache->freePool = cache->pool[record].next;
+    else
+    {
+        if (cache->numPool == cache->maxPool)
+        {
+            int maxPool = cache->maxPool ? cache->maxPool * 2 : 64;
+            RTF_PooledTexture *pool = (RTF_PooledTexture *) SDL_realloc(
+                    cache->pool, maxPool * sizeof(*pool));
+
+            if (!pool)
+            {
+                RTF_FreeSurface(texture);
+                return;
+            }
+            cache->pool = pool;
+            cache->maxPool = maxPool;
+        }
+        record = cache->numPool++;
+    }
+
+    bucket = h * RTF_POOL_SIZES + w;
+    pooled = &cache->pool[record];
+    pooled->texture = texture;
+    pooled->bytes = bytes;
+    pooled->frame = cache->frame;
+    pooled->next = cache->poolBuckets[bucket];
+    cache->poolBuckets[bucket] = record;
+    ++cache->numPooled;
+    cache->pooledBytes += bytes;
+}
+
+/*
+ * Free the textures that have been in the pool for a while, or all of
+ * them.  Like the idle shared textures, they are kept long enough for
+ * every context to render text it laid out again.
+ */
+static void FreePooledTextures(RTF_TextureCache *cache, bool all)
+{
+    Uint32 maxAge = RTF_IDLE_TEXTURE_FRAMES * SDL_max(cache->refCount, 1);
+    int i;
+
+    for (i = 0; i < RTF_POOL_SIZES * RTF_POOL_SIZES && cache->numPooled > 0;
+            ++i)
+    {
+        int *prev = &cache->poolBuckets[i];
+
+        while (*prev >= 0)
+        {
+            int record = *prev;
+            RTF_PooledTexture *pooled = &cache->pool[record];
+
+            if (!all && cache->frame - pooled->frame <= maxAge)
+            {
+                prev = &pooled->next;
+                continue;
+            }
+            *prev = pooled->next;
+            RTF_FreeSurface(pooled->texture);
+            cache->pooledBytes -= pooled->bytes;
+            --cache->numPooled;
+
+            pooled->texture = NULL;
+            pooled->next = cache->freePool;
+            cache->freePool = record;
+        }
+    }
+}
+
+/* Put a slot at the head of the LRU list */
+static void LinkSlot(RTF_TextureCache *cache, int slot)
+{
+    RTF_CachedTexture *entry = &cache->slots[slot];
+
+    entry->prev = -1;
+    entry->next = cache->head;
+    if (cache->head >= 0)
+        cache->slots[cache->head].prev = slot;
+    else
+        cache->tail = slot;
+    cache->head = slot;
+}
+
+static void UnlinkSlot(RTF_TextureCache *cache, int slot)
+{
+    RTF_CachedTexture *entry = &cache->slots[slot];
+
+    if (entry->prev >= 0)
+        cache->slots[entry->prev].next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next >= 0)
+        cache->slots[entry->next].prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+}
+
+/* Free a slot's texture, leaving any handles to it out of date */
+static void FreeSlot(RTF_TextureCache *cache, int slot)
+{
+    RTF_CachedTexture *entry = &cache->slots[slot];
+
+    UnlinkSlot(cache, slot);
+    if (entry->ownerBytes)
+        *entry->ownerBytes -= SDL_min(entry->bytes, *entry->ownerBytes);
+    if (entry->key)
+    {
+        int *prev = &cache->buckets[entry->hash & (cache->numBuckets - 1)];
+
+        while (*prev != slot)
+        {
+            prev = &cache->slots[*prev].hashNext;
+        }
+        *prev = entry->hashNext;
+        if (entry->refCount == 0)
+            --cache->numIdle;
+        --cache->numShared;
+        SDL_free(entry->key);
+        entry->key = NULL;
+    }
+    cache->stats.numTextures--;
+    cache->stats.textureBytes -= entry->bytes;
+    FreeTexture(cache, entry->texture, entry->pooled);
+
+    entry->texture = NULL;
+    entry->ownerBytes = NULL;
+    ++entry->generation;
+    entry->next = cache->freeSlot;
+    cache->freeSlot = slot;
+}
+
+/* Evict the least recently drawn textures until the cache is in budget */
+static void EvictTextures(RTF_TextureCache *cache)
+{
+    if (!cache->maxBytes)
+        return;
+
+    /* Textures that are only kept in case they're needed go first */
+    if (cache->pooledBytes > 0 &&
+            cache->stats.textureBytes + cache->pooledBytes > cache->maxBytes)
+        FreePooledTextures(cache, true);
+
+    while (cache->stats.textureBytes > cache->maxBytes && cache->tail >= 0 &&
+            cache->slots[cache->tail].frame != cache->frame)
+    {
+        FreeSlot(cache, cache->tail);
+        ++cache->stats.evictions;
+    }
+}
+
+/*
+ * Free the shared textures that nothing has used for a while, or all of
+ * them.  Each context sharing the cache gets to render a couple of times
+ * first, so text it laid out again can find its old textures.
+ */
+static void FreeIdleTextures(RTF_TextureCache *cache, bool all)
+{
+    Uint32 maxAge = RTF_IDLE_TEXTURE_FRAMES * SDL_max(cache->refCount, 1);
+    int i;
+
+    for (i = 0; i < cache->numSlots && cache->numIdle > 0; ++i)
+    {
+        RTF_CachedTexture *entry = &cache->slots[i];
+
+        if (entry->texture && entry->key && entry->refCount == 0 &&
+                (all || cache->frame - entry->frame > maxAge))
+            FreeSlot(cache, i);
+    }
+}
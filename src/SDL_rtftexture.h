@@ -0,0 +1,66 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef _SDL_RTFTEXTURE_H
+#define _SDL_RTFTEXTURE_H
+
+#include <SDL3/SDL.h>
+#include <SDL3_rtf/SDL_rtf.h>
+
+/* The textures of every context that draws with the same renderer, kept
+   within a budget by throwing away the least recently drawn ones */
+typedef struct _RTF_TextureCache RTF_TextureCache;
+
+/* What the texture of a piece of text is made from.  Textures added with
+   a key are shared by all the text that has the same one. */
+typedef struct _RTF_TextureKey
+{
+    Uint64 font;                /* from RTF_GetFontKey() */
+    SDL_Color color;            /* the text was rendered in */
+    const char *text;
+    size_t length;              /* in bytes */
+}
+RTF_TextureKey;
+
+RTF_TextureCache *RTF_AcquireTextureCache(SDL_Renderer *renderer);
+void RTF_ReleaseTextureCache(RTF_TextureCache *cache);
+void RTF_SetTextureCacheBudget(RTF_TextureCache *cache, size_t maxBytes);
+void RTF_GetTextureCacheStats(RTF_TextureCache *cache,
+        RTF_TextureStats *stats);
+void RTF_BeginTextureFrame(RTF_TextureCache *cache);
+SDL_Texture *RTF_GetCachedTexture(RTF_TextureCache *cache, int slot,
+        Uint32 generation);
+bool RTF_IsTextureCached(RTF_TextureCache *cache, int slot,
+        Uint32 generation);
+int RTF_AddCachedTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        size_t bytes, bool pooled, size_t *ownerBytes, Uint32 *generation);
+SDL_Texture *RTF_FindSharedTexture(RTF_TextureCache *cache,
+        const RTF_TextureKey *key, int *slot, Uint32 *generation,
+        int *w, int *h);
+int RTF_AddSharedTexture(RTF_TextureCache *cache, SDL_Texture *texture,
+        int w, int h, bool pooled, const RTF_TextureKey *key,
+        Uint32 *generation);
+SDL_Texture *RTF_UploadTexture(RTF_TextureCache *cache,
+        SDL_Surface *pixels);
+void RTF_RemoveCachedTexture(RTF_TextureCache *cache, int slot,
+        Uint32 generation);
+
+#endif /* _SDL_RTFTEXTURE_H */
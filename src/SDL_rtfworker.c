@@ -0,0 +1,197 @@
+/*
+  SDL_rtf:  A companion library to SDL for displaying RTF format text
+  Copyright (C) 2003-2024 Sam Lantinga <slouken@libsdl.org>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <SDL3_rtf/SDL_rtf.h>
+#include "SDL_rtfworker.h"
+
+#include "rtfdecl.h"
+
+struct _RTF_WorkerPool
+{
+    SDL_Mutex *lock;
+    SDL_Condition *jobsReady;
+    SDL_Condition *jobsDone;
+    SDL_Thread **threads;
+    int numThreads;
+    bool quit;
+
+    /* The batch of jobs being run, protected by the lock */
+    RTF_JobFunction func;
+    char *jobs;
+    size_t jobSize;
+    int numJobs;
+    int nextJob;
+    int jobsLeft;
+};
+
+/* static function prototypes */
+static void RunNextJob(RTF_WorkerPool *pool);
+static int SDLCALL WorkerThread(void *data);
+
+/*
+ * %%Function: RTF_CreateWorkerPool
+ *
+ * Create a pool of threads to help the calling thread run jobs.
+ */
+RTF_WorkerPool *RTF_CreateWorkerPool(RTF_Context *ctx, int numThreads)
+{
+    RTF_WorkerPool *pool;
+
+    pool = (RTF_WorkerPool *) RTF_malloc(ctx, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    SDL_memset(pool, 0, sizeof(*pool));
+
+    pool->lock = SDL_CreateMutex();
+    pool->jobsReady = SDL_CreateCondition();
+    pool->jobsDone = SDL_CreateCondition();
+    pool->threads = (SDL_Thread **) RTF_malloc(ctx,
+            numThreads * sizeof(*pool->threads));
+    if (!pool->lock || !pool->jobsReady || !pool->jobsDone || !pool->threads)
+    {
+        RTF_DestroyWorkerPool(ctx, pool);
+        return NULL;
+    }
+
+    while (pool->numThreads < numThreads)
+    {
+        SDL_Thread *thread = SDL_CreateThread(WorkerThread, "RTF_Worker",
+                pool);
+        if (!thread)
+        {
+            RTF_DestroyWorkerPool(ctx, pool);
+            return NULL;
+        }
+        pool->threads[pool->numThreads++] = thread;
+    }
+    return pool;
+}
+
+/*
+ * %%Function: RTF_GetWorkerCount
+ *
+ * Get the number of threads that run jobs, including the calling thread.
+ */
+int RTF_GetWorkerCount(RTF_WorkerPool *pool)
+{
+    return pool ? pool->numThreads + 1 : 1;
+}
+
+/*
+ * %%Function: RTF_RunJobs
+ *
+ * Run a function on each element of an array of jobs and wait for them
+ * all to finish.  The jobs run in no particular order, and the calling
+ * thread runs some of them too.  A NULL pool runs them all in turn.
+ */
+void RTF_RunJobs(RTF_WorkerPool *pool, RTF_JobFunction func, void *jobs,
+        int numJobs, size_t jobSize)
+{
+    int i;
+
+    if (!pool)
+    {
+        for (i = 0; i < numJobs; ++i)
+        {
+            func((char *)jobs + i * jobSize);
+        }
+        return;
+    }
+
+    SDL_LockMutex(pool->lock);
+    pool->func = func;
+    pool->jobs = (char *)jobs;
+    pool->jobSize = jobSize;
+    pool->numJobs = numJobs;
+    pool->nextJob = 0;
+    pool->jobsLeft = numJobs;
+    SDL_BroadcastCondition(pool->jobsReady);
+
+    while (pool->nextJob < pool->numJobs)
+    {
+        RunNextJob(pool);
+    }
+    while (pool->jobsLeft > 0)
+    {
+        SDL_WaitCondition(pool->jobsDone, pool->lock);
+    }
+    pool->numJobs = 0;
+    pool->nextJob = 0;
+    SDL_UnlockMutex(pool->lock);
+}
+
+/*
+ * %%Function: RTF_DestroyWorkerPool
+ */
+void RTF_DestroyWorkerPool(RTF_Context *ctx, RTF_WorkerPool *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    if (pool->numThreads)
+    {
+        SDL_LockMutex(pool->lock);
+        pool->quit = true;
+        SDL_BroadcastCondition(pool->jobsReady);
+        SDL_UnlockMutex(pool->lock);
+        for (i = 0; i < pool->numThreads; ++i)
+        {
+            SDL_WaitThread(pool->threads[i], NULL);
+        }
+    }
+    RTF_free(ctx, pool->threads);
+    SDL_DestroyCondition(pool->jobsDone);
+    SDL_DestroyCondition(pool->jobsReady);
+    SDL_DestroyMutex(pool->lock);
+    RTF_free(ctx, pool);
+}
+
+/* Take the next job in the batch and run it, called with the lock held */
+static void RunNextJob(RTF_WorkerPool *pool)
+{
+    RTF_JobFunction func = pool->func;
+    void *job = pool->jobs + pool->nextJob++ * pool->jobSize;
+
+    SDL_UnlockMutex(pool->lock);
+    func(job);
+    SDL_LockMutex(pool->lock);
+
+    if (--pool->jobsLeft == 0)
+        SDL_BroadcastCondition(pool->jobsDone);
+}
+
+static int SDLCALL WorkerThread(void *data)
+{
+    RTF_WorkerPool *pool = (RTF_WorkerPool *)data;
+
+    SDL_LockMutex(pool->lock);
+    while (!pool->quit)
+    {
+        if (pool->nextJob < pool->numJobs)
+            RunNextJob(pool);
+        else
+            SDL_WaitCondition(pool->jobsReady, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
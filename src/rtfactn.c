@@ -101,7 +101,7 @@ SYM rgsymRtf[] =
     {"qr", justR, true, kwdProp, ipropJust},
     {"qj", justF, true, kwdProp, ipropJust},
     {"paperw", 12240, false, kwdProp, ipropXaPage},
-    {"paperh", 15480, false, kwdProp, ipropYaPage},
+    {"paperh", 15840, false, kwdProp, ipropYaPage},
     {"margl", 1800, false, kwdProp, ipropXaLeft},
     {"margr", 1800, false, kwdProp, ipropXaRight},
     {"margt", 1440, false, kwdProp, ipropYaTop},
@@ -361,21 +361,21 @@ int ecEndGroupAction(RTF_Context *ctx, RDS rds)
     switch (ctx->rds)
     {
         case rdsTitle:
-            SDL_free(ctx->title);
+            RTF_free(ctx, ctx->title);
             ctx->data[ctx->datapos] = '\0';
-            ctx->title = *ctx->data ? SDL_strdup(ctx->data) : NULL;
+            ctx->title = *ctx->data ? RTF_strdup(ctx, ctx->data) : NULL;
             ctx->datapos = 0;
             break;
         case rdsSubject:
-            SDL_free(ctx->subject);
+            RTF_free(ctx, ctx->subject);
             ctx->data[ctx->datapos] = '\0';
-            ctx->subject = *ctx->data ? SDL_strdup(ctx->data) : NULL;
+            ctx->subject = *ctx->data ? RTF_strdup(ctx, ctx->data) : NULL;
             ctx->datapos = 0;
             break;
         case rdsAuthor:
-            SDL_free(ctx->author);
+            RTF_free(ctx, ctx->author);
             ctx->data[ctx->datapos] = '\0';
-            ctx->author = *ctx->data ? SDL_strdup(ctx->data) : NULL;
+            ctx->author = *ctx->data ? RTF_strdup(ctx, ctx->data) : NULL;
             ctx->datapos = 0;
             break;
         default:
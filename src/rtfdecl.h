@@ -24,17 +24,29 @@ int ecParseHexByte(RTF_Context * ctx);
 int ecAddFontEntry(RTF_Context *ctx, int number, const char *name,
         int family, int charset);
 void *ecLookupFont(RTF_Context *ctx);
+Uint64 ecGetFontKey(RTF_Context *ctx, void *font);
 int ecClearFonts(RTF_Context *ctx);
+int ecEvictFonts(RTF_Context *ctx, bool flush);
 
 int ecAddColorEntry(RTF_Context *ctx, int r, int g, int b);
-void *ecLookupColor(RTF_Context *ctx);
+SDL_Color ecLookupColor(RTF_Context *ctx);
 int ecClearColors(RTF_Context *ctx);
 
+int ecGrowArray(RTF_Context *ctx, void **array, int *max, int count,
+        size_t size);
+
 int ecAddLine(RTF_Context *ctx);
 int ecAddTab(RTF_Context *ctx);
 int ecAddText(RTF_Context *ctx, const char *text);
+int ecLineLength(RTF_Context *ctx, int index);
+int ecEditText(RTF_Context *ctx, int index, int offset, int numChars,
+        const char *text, RTF_Edit *edit);
+int ecReplaceLine(RTF_Context *ctx, int index, RTF_Edit *edit);
+int ecReloadText(RTF_Context *ctx, RTF_LineMatch **matches,
+        int *numOldLines);
 
 int ecClearLines(RTF_Context *ctx);
+int ecResetContext(RTF_Context *ctx);
 int ecClearContext(RTF_Context *ctx);
 
 int ecRtfGetChar(RTF_Context *ctx, int *ch);
@@ -52,18 +64,30 @@ int ecTabstop(RTF_Context *ctx);
 int ecLinebreak(RTF_Context *ctx);
 int ecParagraph(RTF_Context *ctx);
 
+/* 64-bit FNV-1a hashing, shared by the parser and the texture cache */
+
+#define RTF_HASH_INIT   0xcbf29ce484222325ULL
+
+Uint64 RTF_HashBytes(Uint64 hash, const void *data, size_t size);
+
 /* custom rtfreader.c prototypes (defined per library) */
 
+void *RTF_malloc(RTF_Context *ctx, size_t size);
+void *RTF_realloc(RTF_Context *ctx, void *mem, size_t size);
+void RTF_free(RTF_Context *ctx, void *mem);
+char *RTF_strdup(RTF_Context *ctx, const char *string);
+
 void *RTF_CreateFont(void *fontEngine, const char *name, int family,
 int charset, int size, int style);
 void RTF_FreeFont(void *fontEngine, void *font);
-void *RTF_CreateColor(int r, int g, int b);
-void RTF_FreeColor(void *color);
+Uint64 RTF_GetFontKey(void *fontEngine, const void *instance,
+        const char *name, int family, int charset, int size, int style);
 int RTF_GetLineSpacing(void *fontEngine, void *font);
 int RTF_GetCharacterOffsets(void *fontEngine, void *font,
         const char *text, int *byteOffsets, int *pixelOffsets,
         int maxOffsets);
 void RTF_FreeSurface(void *surface);
+void RTF_ClearLayouts(RTF_Context *ctx, bool keepMemory);
 int RTF_GetChar(void *stream, unsigned char *c);
 
 /* RTF parser error codes */
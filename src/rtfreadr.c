@@ -8,9 +8,60 @@
 #include "rtftype.h"
 #include "rtfdecl.h"
 
+/* How far ahead a reload looks for the old version of a line */
+#define RTF_RELOAD_MATCH_WINDOW 64
+
+/* The parts of a context that make up the loaded document, so that a new
+   version can be parsed while the old one is kept around */
+typedef struct _RTF_Document
+{
+    RTF_FontEntry *fontTable;
+    RTF_ColorEntry *colorTable;
+    char *title;
+    char *subject;
+    char *author;
+    int cGroup;
+    RDS rds;
+    RIS ris;
+    CHP chp;
+    PAP pap;
+    SEP sep;
+    DOP dop;
+    SAVE *psave;
+    RTF_Line *lines;
+    int numLines;
+    int maxLines;
+    RTF_TextBlock *blocks;
+    int numBlocks;
+    int maxBlocks;
+}
+RTF_Document;
+
 /* static function prototypes */
-static void FreeLine(RTF_Line *line);
-static void FreeTextBlock(RTF_TextBlock *text);
+static void *LookupCachedFont(RTF_Context *ctx, RTF_FontEntry *entry,
+        int size, int style);
+static int AddText(RTF_Context *ctx, void *font, SDL_Color color,
+        const char *text);
+static int AppendText(RTF_Context *ctx, RTF_TextBlock *textBlock,
+        const char *text);
+static int FindBreaks(RTF_Context *ctx, RTF_TextBlock *textBlock, int first);
+static void FreeTextBlock(RTF_Context *ctx, RTF_TextBlock *text);
+static bool FontInUse(RTF_Context *ctx, void *font);
+static int AddLineLike(RTF_Context *ctx, int index);
+static int CopyText(RTF_Context *ctx, int index, int from, int to);
+static int FindTextStyle(RTF_Context *ctx, int index, int offset,
+        void **font, SDL_Color *color);
+static int SpliceLines(RTF_Context *ctx, int index, int numOld,
+        int firstNew, RTF_Edit *edit);
+static void DiscardLines(RTF_Context *ctx, int firstNew, int firstBlock);
+static void SaveDocument(RTF_Context *ctx, RTF_Document *doc);
+static void RestoreDocument(RTF_Context *ctx, const RTF_Document *doc);
+static void FreeDocument(RTF_Context *ctx);
+static Uint64 HashLine(const RTF_Line *line, const RTF_TextBlock *blocks);
+static bool SameLine(const RTF_Line *a, const RTF_TextBlock *aBlocks,
+        const RTF_Line *b, const RTF_TextBlock *bBlocks);
+static int MatchLines(RTF_Context *ctx, const RTF_Document *old,
+        RTF_LineMatch *matches);
 
 /*
  * %%Function: ecAddFontEntry
@@ -18,13 +69,13 @@ static void FreeTextBlock(RTF_TextBlock *text);
 int ecAddFontEntry(RTF_Context *ctx, int number, const char *name,
         int family, int charset)
 {
-    RTF_FontEntry *entry = (RTF_FontEntry *) SDL_malloc(sizeof(*entry));
+    RTF_FontEntry *entry = (RTF_FontEntry *) RTF_malloc(ctx, sizeof(*entry));
 
     if (!entry)
         return ecStackOverflow;
 
     entry->number = number;
-    entry->name = SDL_strdup(name);
+    entry->name = RTF_strdup(ctx, name);
     entry->family = (RTF_FontFamily) family;
     entry->charset = charset;
     entry->fonts = NULL;
@@ -89,15 +140,14 @@ void *ecLookupFont(RTF_Context *ctx)
     }
 
     /* Create a new font entry */
-    font = (RTF_Font *) SDL_malloc(sizeof(*font));
+    font = (RTF_Font *) RTF_malloc(ctx, sizeof(*font));
     if (!font)
         return NULL;
 
-    font->font = RTF_CreateFont(ctx->fontEngine, entry->name,
-            entry->family, entry->charset, size, style);
+    font->font = LookupCachedFont(ctx, entry, size, style);
     if (!font->font)
     {
-        SDL_free(font);
+        RTF_free(ctx, font);
         return NULL;
     }
     font->size = size;
@@ -109,25 +159,87 @@ void *ecLookupFont(RTF_Context *ctx)
 
 /*
  * %%Function: ecClearFonts
+ *
+ * Free the font table.  The font instances stay in the font cache, marked
+ * as last used now, so the next document can pick them up again.
  */
 int ecClearFonts(RTF_Context *ctx)
 {
+    Uint64 now = SDL_GetTicks();
+
     while (ctx->fontTable)
     {
         RTF_FontEntry *entry = ctx->fontTable;
 
         ctx->fontTable = entry->next;
-        SDL_free(entry->name);
+        RTF_free(ctx, entry->name);
         while (entry->fonts)
         {
             RTF_Font *font = entry->fonts;
+            int i;
 
             entry->fonts = font->next;
-            RTF_FreeFont(ctx->fontEngine, font->font);
-            SDL_free(font);
+            for (i = 0; i < ctx->numCachedFonts; ++i)
+            {
+                if (ctx->fontCache[i].font == font->font)
+                {
+                    ctx->fontCache[i].lastUsed = now;
+                    break;
+                }
+            }
+            RTF_free(ctx, font);
+        }
+        RTF_free(ctx, entry);
+    }
+    return ecOK;
+}
+
+/*
+ * %%Function: ecGetFontKey
+ *
+ * Get the key of a font instance, which identifies it to the contexts
+ * that share textures.  Returns 0 if the font isn't in the cache.
+ */
+Uint64 ecGetFontKey(RTF_Context *ctx, void *font)
+{
+    int i;
+
+    for (i = 0; i < ctx->numCachedFonts; ++i)
+    {
+        if (ctx->fontCache[i].font == font)
+            return ctx->fontCache[i].key;
+    }
+    return 0;
+}
+
+/*
+ * %%Function: ecEvictFonts
+ *
+ * Free cached font instances that no document has used for longer than
+ * the font cache timeout, or all of them if flush is true.  The fonts of
+ * the loaded document are only freed by a flush.
+ */
+int ecEvictFonts(RTF_Context *ctx, bool flush)
+{
+    Uint64 now = SDL_GetTicks();
+    int i, kept = 0;
+
+    for (i = 0; i < ctx->numCachedFonts; ++i)
+    {
+        RTF_CachedFont *cached = &ctx->fontCache[i];
+
+        if (flush || ((now - cached->lastUsed) > ctx->fontCacheTimeout &&
+                !FontInUse(ctx, cached->font)))
+        {
+            RTF_FreeFont(ctx->fontEngine, cached->font);
+            RTF_free(ctx, cached->name);
+        }
+        else
+        {
+            ctx->fontCache[kept++] = *cached;
         }
-        SDL_free(entry);
     }
+    ctx->numCachedFonts = kept;
     return ecOK;
 }
 
@@ -137,16 +249,16 @@ int ecClearFonts(RTF_Context *ctx)
 int ecAddColorEntry(RTF_Context *ctx, int r, int g, int b)
 {
     RTF_ColorEntry *ptr;
-    RTF_ColorEntry *entry = (RTF_ColorEntry *) SDL_malloc(sizeof(*entry));
+    RTF_ColorEntry *entry =
+            (RTF_ColorEntry *) RTF_malloc(ctx, sizeof(*entry));
 
     if (!entry)
         return ecStackOverflow;
 
-    entry->color = RTF_CreateColor(r, g, b);
-    entry->r = r & 0xFF;
-    entry->g = g & 0xFF;
-    entry->b = b & 0xFF;
-    entry->a = 0;
+    entry->color.r = r & 0xFF;
+    entry->color.g = g & 0xFF;
+    entry->color.b = b & 0xFF;
+    entry->color.a = SDL_ALPHA_OPAQUE;
     entry->next = NULL;
     if (!ctx->colorTable)
         ctx->colorTable = entry;
@@ -160,17 +272,25 @@ int ecAddColorEntry(RTF_Context *ctx, int r, int g, int b)
 
 /*
  * %%Function: ecLookupColor
+ *
+ * Text without a color in the table is opaque black.  The alpha matters
+ * when the color is used to modulate text rendered in white.
  */
-void *ecLookupColor(RTF_Context *ctx)
+SDL_Color ecLookupColor(RTF_Context *ctx)
 {
     RTF_ColorEntry *ptr;
     int index = ctx->chp.fFgColor;
+    SDL_Color color;
 
     for (ptr = ctx->colorTable; ptr && index > 0; ptr = ptr->next,
             index--);
     if (ptr && index >= 0)
         return ptr->color;
-    return NULL;
+    color.r = 0;
+    color.g = 0;
+    color.b = 0;
+    color.a = SDL_ALPHA_OPAQUE;
+    return color;
 }
 
 /*
@@ -183,9 +303,32 @@ int ecClearColors(RTF_Context *ctx)
     for (e = ctx->colorTable; e; e = e2)
     {
         e2 = e->next;
-        RTF_FreeColor(e->color);
-        SDL_free(e);
+        RTF_free(ctx, e);
     }
+    ctx->colorTable = NULL;
+    return ecOK;
+}
+
+/*
+ * %%Function: ecGrowArray
+ *
+ * Make sure a growable array has room for at least one more element
+ */
+int ecGrowArray(RTF_Context *ctx, void **array, int *max, int count,
+        size_t size)
+{
+    void *grown;
+    int newmax;
+
+    if (count < *max)
+        return ecOK;
+
+    newmax = *max ? (*max * 2) : 64;
+    grown = RTF_realloc(ctx, *array, newmax * size);
+    if (!grown)
+        return ecStackOverflow;
+    *array = grown;
+    *max = newmax;
     return ecOK;
 }
 
@@ -202,28 +345,20 @@ int ecAddLine(RTF_Context *ctx)
     if (!font)
         return ecFontNotFound;
 
-    line = (RTF_Line *) SDL_malloc(sizeof(*line));
-    if (!line)
+    if (ecGrowArray(ctx, (void **)&ctx->lines, &ctx->maxLines,
+            ctx->numLines, sizeof(*line)) != ecOK)
         return ecStackOverflow;
+    line = &ctx->lines[ctx->numLines++];
 
     line->pap = ctx->pap;
-    line->lineWidth = 0;
     line->lineHeight = RTF_GetLineSpacing(ctx->fontEngine, font);
     line->tabs = 0;
-    line->start = NULL;
-    line->last = NULL;
-    line->startSurface = NULL;
-    line->lastSurface = NULL;
-    line->next = NULL;
+    line->block = ctx->numBlocks;
+    line->numBlocks = 0;
 
 #ifdef DEBUG_RTF
     fprintf(stderr, "Added line ---------------------\n");
 #endif
-    if (ctx->start)
-        ctx->last->next = line;
-    else
-        ctx->start = line;
-    ctx->last = line;
     return ecOK;
 }
 
@@ -235,14 +370,14 @@ int ecAddTab(RTF_Context *ctx)
     RTF_Line *line;
 
     /* Add the tabs to the last line added */
-    if (!ctx->last)
+    if (!ctx->numLines)
     {
         int status = ecAddLine(ctx);
 
         if (status != ecOK)
             return status;
     }
-    line = ctx->last;
+    line = &ctx->lines[ctx->numLines - 1];
 
     ++line->tabs;
     return ecOK;
@@ -253,10 +388,6 @@ int ecAddTab(RTF_Context *ctx)
  */
 int ecAddText(RTF_Context *ctx, const char *text)
 {
-    RTF_Line *line;
-    RTF_TextBlock *textBlock;
-    int numChars;
-
     /* Lookup the current font */
     void *font = ecLookupFont(ctx);
 
@@ -264,48 +395,318 @@ int ecAddText(RTF_Context *ctx, const char *text)
         return ecFontNotFound;
 
     /* Add the text to the last line added */
-    if (!ctx->last)
+    if (!ctx->numLines)
     {
         int status = ecAddLine(ctx);
 
         if (status != ecOK)
             return status;
     }
-    line = ctx->last;
+    ctx->lines[ctx->numLines - 1].pap = ctx->pap;
+    return AddText(ctx, font, ecLookupColor(ctx), text);
+}
+
+/*
+ * %%Function: ecLineLength
+ *
+ * Count the characters of text in a line.
+ */
+int ecLineLength(RTF_Context *ctx, int index)
+{
+    RTF_Line *line = &ctx->lines[index];
+    int i, length = 0;
+
+    for (i = 0; i < line->numBlocks; ++i)
+    {
+        length += ctx->blocks[line->block + i].numChars;
+    }
+    return length;
+}
+
+/*
+ * %%Function: ecEditText
+ *
+ * Delete numChars characters of a line, starting at offset, and insert
+ * text in their place.  The end of a line counts as a character, so
+ * deleting it joins the line with the next one, and a newline in the text
+ * splits the line.  The inserted text gets the font and color of the
+ * character before it.
+ *
+ * The edited lines are built at the end of the document and then moved in
+ * place of the old ones, which leaves the document as it was if anything
+ * fails.
+ */
+int ecEditText(RTF_Context *ctx, int index, int offset, int numChars,
+        const char *text, RTF_Edit *edit)
+{
+    int endIndex = index;
+    int endOffset = offset + numChars;
+    int firstNew, firstBlock;
+    int lineLength, length, status;
+    void *font;
+    SDL_Color color;
+
+    if (!ctx->numLines)
+    {
+        /* There's nothing laid out to keep */
+        RTF_ClearLayouts(ctx, true);
+        status = ecAddLine(ctx);
+        if (status != ecOK)
+            return status;
+    }
+    firstNew = ctx->numLines;
+    firstBlock = ctx->numBlocks;
+
+    /* Find where the deleted text ends */
+    lineLength = ecLineLength(ctx, index);
+    length = lineLength;
+    while (endOffset > length && endIndex < ctx->numLines - 1)
+    {
+        endOffset -= length + 1;
+        ++endIndex;
+        length = ecLineLength(ctx, endIndex);
+    }
+    if (endOffset > length)
+        endOffset = length;
+
+    status = FindTextStyle(ctx, index, offset, &font, &color);
+    if (status == ecOK)
+        status = AddLineLike(ctx, index);
+    if (status == ecOK)
+        status = CopyText(ctx, index, 0, offset);
+
+    /* Tabs at the end of the line come before text added there */
+    if (status == ecOK && offset == lineLength)
+        ctx->lines[ctx->numLines - 1].tabs += ctx->lines[index].tabs;
+
+    while (status == ecOK && *text)
+    {
+        const char *end = SDL_strchr(text, '\n');
+        size_t size = end ? (size_t)(end - text) : SDL_strlen(text);
+
+        if (size > 0)
+        {
+            char *piece = (char *) RTF_malloc(ctx, size + 1);
+
+            if (!piece)
+            {
+                status = ecStackOverflow;
+                break;
+            }
+            SDL_memcpy(piece, text, size);
+            piece[size] = '\0';
+            status = AddText(ctx, font, color, piece);
+            RTF_free(ctx, piece);
+        }
+        if (!end || status != ecOK)
+            break;
+        status = AddLineLike(ctx, index);
+        text = end + 1;
+    }
+
+    if (status == ecOK)
+        status = CopyText(ctx, endIndex, endOffset, -1);
+    if (status == ecOK && (endIndex != index || offset != lineLength))
+        ctx->lines[ctx->numLines - 1].tabs += ctx->lines[endIndex].tabs;
+
+    if (status == ecOK)
+        status = SpliceLines(ctx, index, endIndex - index + 1, firstNew,
+                edit);
+    if (status != ecOK)
+        DiscardLines(ctx, firstNew, firstBlock);
+    return status;
+}
 
-    textBlock = (RTF_TextBlock *) SDL_malloc(sizeof(*textBlock));
-    if (!textBlock)
+/*
+ * %%Function: ecReplaceLine
+ *
+ * Replace a line with RTF text read from the input stream.  The text is
+ * parsed with the font and color tables of the document, starting with
+ * the paragraph formatting of the line and plain character formatting,
+ * and may contain several paragraphs.  The state of the parser is saved
+ * and restored around it, so appending to the document still continues
+ * where it left off.
+ */
+int ecReplaceLine(RTF_Context *ctx, int index, RTF_Edit *edit)
+{
+    CHP chp = ctx->chp;
+    PAP pap = ctx->pap;
+    SEP sep = ctx->sep;
+    DOP dop = ctx->dop;
+    RDS rds = ctx->rds;
+    RIS ris = ctx->ris;
+    SAVE *psave = ctx->psave;
+    int cGroup = ctx->cGroup;
+    int firstNew, firstBlock;
+    int status;
+
+    if (!ctx->numLines)
+    {
+        RTF_ClearLayouts(ctx, true);
+        status = ecAddLine(ctx);
+        if (status != ecOK)
+            return status;
+    }
+    firstNew = ctx->numLines;
+    firstBlock = ctx->numBlocks;
+
+    status = AddLineLike(ctx, index);
+    if (status == ecOK)
+    {
+        SDL_memset(&ctx->chp, 0, sizeof(ctx->chp));
+        ctx->pap = ctx->lines[index].pap;
+        ctx->rds = rdsNorm;
+        ctx->ris = risNorm;
+        ctx->psave = NULL;
+        ctx->cGroup = 0;
+
+        status = ecRtfParse(ctx);
+        if (status == ecOK)
+            status = ecProcessData(ctx);
+        while (ctx->psave)
+        {
+            ecPopRtfState(ctx);
+        }
+        ctx->datapos = 0;
+
+        ctx->chp = chp;
+        ctx->pap = pap;
+        ctx->sep = sep;
+        ctx->dop = dop;
+        ctx->rds = rds;
+        ctx->ris = ris;
+        ctx->psave = psave;
+        ctx->cGroup = cGroup;
+    }
+
+    if (status == ecOK)
+        status = SpliceLines(ctx, index, 1, firstNew, edit);
+    if (status != ecOK)
+        DiscardLines(ctx, firstNew, firstBlock);
+    return status;
+}
+
+/*
+ * %%Function: ecReloadText
+ *
+ * Replace the document with a new version of it from the input stream.
+ * Each line of the new version is matched up with the same line in the
+ * old one, if it is still there, so that its layout can be kept.  The
+ * matches are allocated for the caller to free.  If the new version can't
+ * be parsed, the old one is left as it was.
+ */
+int ecReloadText(RTF_Context *ctx, RTF_LineMatch **matches,
+        int *numOldLines)
+{
+    RTF_Document old, parsed;
+    int status;
+
+    SaveDocument(ctx, &old);
+    ctx->cbBin = 0;
+    ctx->fSkipDestIfUnk = 0;
+    ctx->datapos = 0;
+    SDL_memset(ctx->values, 0, sizeof(ctx->values));
+
+    status = ecRtfParse(ctx);
+    while (ctx->psave)
+    {
+        ecPopRtfState(ctx);
+    }
+
+    *matches = NULL;
+    if (status == ecOK)
+    {
+        /* One extra, so an empty document doesn't look like a failure */
+        *matches = (RTF_LineMatch *) RTF_malloc(ctx,
+                (ctx->numLines + 1) * sizeof(**matches));
+        if (!*matches)
+            status = ecStackOverflow;
+    }
+    if (status == ecOK)
+        status = MatchLines(ctx, &old, *matches);
+    if (status != ecOK)
+    {
+        RTF_free(ctx, *matches);
+        *matches = NULL;
+        FreeDocument(ctx);
+        RestoreDocument(ctx, &old);
+        return status;
+    }
+
+    /* The fonts of the lines that are kept are in the new font table too,
+       so the old document can go now */
+    *numOldLines = old.numLines;
+    SaveDocument(ctx, &parsed);
+    RestoreDocument(ctx, &old);
+    FreeDocument(ctx);
+    RestoreDocument(ctx, &parsed);
+    ecEvictFonts(ctx, false);
+    return ecOK;
+}
+
+/*
+ * %%Function: AddText
+ *
+ * Add text with a font and color to the last line.
+ */
+static int AddText(RTF_Context *ctx, void *font, SDL_Color color,
+        const char *text)
+{
+    RTF_Line *line = &ctx->lines[ctx->numLines - 1];
+    RTF_TextBlock *textBlock;
+    int numChars;
+
+    /* Text that only has formatting-neutral controls or groups between it
+       and the previous block is added to that block, so it gets drawn as
+       a single run instead of one texture per fragment.
+     */
+    if (line->numBlocks > 0 && !line->tabs)
+    {
+        textBlock = &ctx->blocks[ctx->numBlocks - 1];
+        if (textBlock->font == font &&
+                SDL_memcmp(&textBlock->color, &color, sizeof(color)) == 0)
+            return AppendText(ctx, textBlock, text);
+    }
+
+    /* The blocks of the last line are always at the end of the array */
+    if (ecGrowArray(ctx, (void **)&ctx->blocks, &ctx->maxBlocks,
+            ctx->numBlocks, sizeof(*textBlock)) != ecOK)
         return ecStackOverflow;
+    textBlock = &ctx->blocks[ctx->numBlocks];
 
     textBlock->font = font;
-    textBlock->color = ecLookupColor(ctx);
+    textBlock->color = color;
     numChars = SDL_strlen(text) + 1;
     textBlock->tabs = line->tabs;
-    textBlock->text = SDL_strdup(text);
-    textBlock->byteOffsets = (int *) SDL_malloc(numChars * sizeof(int));
-    textBlock->pixelOffsets = (int *) SDL_malloc(numChars * sizeof(int));
+    textBlock->text = RTF_strdup(ctx, text);
+    textBlock->byteOffsets =
+            (int *) RTF_malloc(ctx, numChars * sizeof(int));
+    textBlock->pixelOffsets =
+            (int *) RTF_malloc(ctx, numChars * sizeof(int));
+    textBlock->breaks = NULL;
+    textBlock->numBreaks = 0;
     if (!textBlock->text || !textBlock->byteOffsets ||
             !textBlock->pixelOffsets)
     {
-        FreeTextBlock(textBlock);
+        FreeTextBlock(ctx, textBlock);
         return ecStackOverflow;
     }
     textBlock->numChars = RTF_GetCharacterOffsets(ctx->fontEngine, font,
             text, textBlock->byteOffsets, textBlock->pixelOffsets,
             numChars);
+    if (FindBreaks(ctx, textBlock, 0) != ecOK)
+    {
+        FreeTextBlock(ctx, textBlock);
+        return ecStackOverflow;
+    }
     textBlock->lineHeight = RTF_GetLineSpacing(ctx->fontEngine, font);
-    textBlock->next = NULL;
 
 #ifdef DEBUG_RTF
     fprintf(stderr, "Added text: '%s'\n", text);
 #endif
-    line->pap = ctx->pap;
     line->tabs = 0;
-    if (line->start)
-        line->last->next = textBlock;
-    else
-        line->start = textBlock;
-    line->last = textBlock;
+    ++line->numBlocks;
+    ++ctx->numBlocks;
     return ecOK;
 }
 
@@ -314,29 +715,35 @@ int ecAddText(RTF_Context *ctx, const char *text)
  */
 int ecClearLines(RTF_Context *ctx)
 {
-    while (ctx->start)
-    {
-        RTF_Line *line = ctx->start;
+    int i;
+
+    /* The arrays themselves are kept around for the next document */
+    RTF_ClearLayouts(ctx, true);
 
-        ctx->start = line->next;
-        FreeLine(line);
+    for (i = 0; i < ctx->numBlocks; ++i)
+    {
+        FreeTextBlock(ctx, &ctx->blocks[i]);
     }
-    ctx->last = NULL;
+    ctx->numBlocks = 0;
+
+    ctx->numLines = 0;
     return ecOK;
 }
 
 /*
- * %%Function: ecClearContext
+ * %%Function: ecResetContext
+ *
+ * Throw away the current document, keeping allocated buffers and font
+ * instances around so that loading the next document is cheaper.
  */
-int ecClearContext(RTF_Context *ctx)
+int ecResetContext(RTF_Context *ctx)
 {
-    if (ctx->data)
+    while (ctx->psave)
     {
-        SDL_free(ctx->data);
-        ctx->data = NULL;
-        ctx->datapos = 0;
-        ctx->datamax = 0;
+        ecPopRtfState(ctx);
     }
+    ctx->cGroup = 0;
+    ctx->datapos = 0;
     SDL_memset(ctx->values, 0, sizeof(ctx->values));
 
     ecClearFonts(ctx);
@@ -344,17 +751,17 @@ int ecClearContext(RTF_Context *ctx)
 
     if (ctx->title)
     {
-        SDL_free(ctx->title);
+        RTF_free(ctx, ctx->title);
         ctx->title = NULL;
     }
     if (ctx->subject)
     {
-        SDL_free(ctx->subject);
+        RTF_free(ctx, ctx->subject);
         ctx->subject = NULL;
     }
     if (ctx->author)
     {
-        SDL_free(ctx->author);
+        RTF_free(ctx, ctx->author);
         ctx->author = NULL;
     }
 
@@ -363,10 +770,52 @@ int ecClearContext(RTF_Context *ctx)
     SDL_memset(&ctx->sep, 0, sizeof(ctx->sep));
     SDL_memset(&ctx->dop, 0, sizeof(ctx->dop));
 
+    /* The layouts may still have text made with the fonts */
     ecClearLines(ctx);
+    ecEvictFonts(ctx, false);
 
-    ctx->displayWidth = 0;
-    ctx->displayHeight = 0;
+    ctx->anchorLine = 0;
+    ctx->anchorOffset = 0;
+    ctx->anchorHeight = 0;
+
+    return ecOK;
+}
+
+/*
+ * %%Function: ecClearContext
+ *
+ * Throw away the current document and free everything it was using.
+ */
+int ecClearContext(RTF_Context *ctx)
+{
+    ecResetContext(ctx);
+    ecEvictFonts(ctx, true);
+
+    while (ctx->psaveFree)
+    {
+        SAVE *psave = ctx->psaveFree;
+
+        ctx->psaveFree = psave->pNext;
+        RTF_free(ctx, psave);
+    }
+
+    RTF_free(ctx, ctx->data);
+    ctx->data = NULL;
+    ctx->datamax = 0;
+
+    RTF_free(ctx, ctx->fontCache);
+    ctx->fontCache = NULL;
+    ctx->maxCachedFonts = 0;
+
+    RTF_ClearLayouts(ctx, false);
+
+    RTF_free(ctx, ctx->blocks);
+    ctx->blocks = NULL;
+    ctx->maxBlocks = 0;
+
+    RTF_free(ctx, ctx->lines);
+    ctx->lines = NULL;
+    ctx->maxLines = 0;
 
     return ecOK;
 }
@@ -503,8 +952,12 @@ int ecRtfParse(RTF_Context *ctx)
  */
 int ecPushRtfState(RTF_Context *ctx)
 {
-    SAVE *psaveNew = SDL_malloc(sizeof(SAVE));
+    SAVE *psaveNew = ctx->psaveFree;
 
+    if (psaveNew)
+        ctx->psaveFree = psaveNew->pNext;
+    else
+        psaveNew = RTF_malloc(ctx, sizeof(SAVE));
     if (!psaveNew)
         return ecStackOverflow;
 
@@ -512,7 +965,6 @@ int ecPushRtfState(RTF_Context *ctx)
     psaveNew->chp = ctx->chp;
     psaveNew->pap = ctx->pap;
     psaveNew->sep = ctx->sep;
-    psaveNew->dop = ctx->dop;
     psaveNew->rds = ctx->rds;
     psaveNew->ris = ctx->ris;
     ctx->ris = risNorm;
@@ -526,7 +978,8 @@ int ecPushRtfState(RTF_Context *ctx)
  *
  * If we're ending a destination (that is, the destination is changing),
  * call ecEndGroupAction.
- * Always restore relevant info from the top of the SAVE list.
+ * Always restore relevant info from the top of the SAVE list.  Document
+ * properties apply to the whole document, so they aren't restored.
  */
 int ecPopRtfState(RTF_Context *ctx)
 {
@@ -545,14 +998,14 @@ int ecPopRtfState(RTF_Context *ctx)
     ctx->chp = ctx->psave->chp;
     ctx->pap = ctx->psave->pap;
     ctx->sep = ctx->psave->sep;
-    ctx->dop = ctx->psave->dop;
     ctx->rds = ctx->psave->rds;
     ctx->ris = ctx->psave->ris;
 
     psaveOld = ctx->psave;
     ctx->psave = ctx->psave->pNext;
     ctx->cGroup--;
-    SDL_free(psaveOld);
+    psaveOld->pNext = ctx->psaveFree;
+    ctx->psaveFree = psaveOld;
     return ecOK;
 }
 
@@ -692,7 +1145,7 @@ int ecPrintChar(RTF_Context *ctx, int ch)
     if (ctx->datapos >= (ctx->datamax - 4))
     {
         ctx->datamax += 256;    /* 256 byte chunk size */
-        ctx->data = (char *) SDL_realloc(ctx->data, ctx->datamax);
+        ctx->data = (char *) RTF_realloc(ctx, ctx->data, ctx->datamax);
         if (!ctx->data)
         {
             return ecStackOverflow;
@@ -789,31 +1242,620 @@ int ecParagraph(RTF_Context *ctx)
     return ecLinebreak(ctx);
 }
 
-static void FreeLine(RTF_Line *line)
+/* Find out if the font table of the document uses a font instance */
+static bool FontInUse(RTF_Context *ctx, void *font)
 {
-    while (line->startSurface)
+    RTF_FontEntry *entry;
+    RTF_Font *used;
+
+    for (entry = ctx->fontTable; entry; entry = entry->next)
     {
-        RTF_Surface *surface = line->startSurface;
-        line->startSurface = surface->next;
-        RTF_FreeSurface(surface->surface);
-        SDL_free(surface);
+        for (used = entry->fonts; used; used = used->next)
+        {
+            if (used->font == font)
+                return true;
+        }
     }
-    while (line->start)
+    return false;
+}
+
+static void *LookupCachedFont(RTF_Context *ctx, RTF_FontEntry *entry,
+        int size, int style)
+{
+    RTF_CachedFont *cached;
+    const char *name = entry->name ? entry->name : "";
+    int i;
+
+    for (i = 0; i < ctx->numCachedFonts; ++i)
+    {
+        cached = &ctx->fontCache[i];
+        if (cached->size == size && cached->style == style &&
+                cached->family == entry->family &&
+                cached->charset == entry->charset &&
+                SDL_strcmp(cached->name, name) == 0)
+        {
+            cached->lastUsed = SDL_GetTicks();
+            return cached->font;
+        }
+    }
+
+    if (ecGrowArray(ctx, (void **)&ctx->fontCache, &ctx->maxCachedFonts,
+            ctx->numCachedFonts, sizeof(*cached)) != ecOK)
+        return NULL;
+    cached = &ctx->fontCache[ctx->numCachedFonts];
+    cached->name = RTF_strdup(ctx, name);
+    if (!cached->name)
+        return NULL;
+    cached->font = RTF_CreateFont(ctx->fontEngine, name, entry->family,
+            entry->charset, size, style);
+    if (!cached->font)
+    {
+        RTF_free(ctx, cached->name);
+        return NULL;
+    }
+    cached->family = entry->family;
+    cached->charset = entry->charset;
+    cached->size = size;
+    cached->style = style;
+    cached->key = RTF_GetFontKey(ctx->fontEngine, ctx->fontEngineInstance,
+            name, entry->family, entry->charset, size, style);
+    cached->lastUsed = SDL_GetTicks();
+    ++ctx->numCachedFonts;
+    return cached->font;
+}
+
+/*
+ * Find the places where the text can be wrapped, which is after each space
+ * other than one at the very start.  They don't depend on the width, so
+ * reflow only has to look them up.  Characters before first have already
+ * been looked at.
+ */
+static int FindBreaks(RTF_Context *ctx, RTF_TextBlock *textBlock, int first)
+{
+    int i, num = 0;
+    int *breaks;
+
+    if (first < 1)
+        first = 1;
+    for (i = first; i < textBlock->numChars; ++i)
+    {
+        if (SDL_isspace(textBlock->text[textBlock->byteOffsets[i]]))
+            ++num;
+    }
+    if (!num)
+        return ecOK;
+
+    breaks = (int *) RTF_realloc(ctx, textBlock->breaks,
+            (textBlock->numBreaks + num) * sizeof(int));
+    if (!breaks)
+        return ecStackOverflow;
+    textBlock->breaks = breaks;
+    for (i = first; i < textBlock->numChars; ++i)
+    {
+        if (SDL_isspace(textBlock->text[textBlock->byteOffsets[i]]))
+            textBlock->breaks[textBlock->numBreaks++] = i + 1;
+    }
+    return ecOK;
+}
+
+/*
+ * %%Function: AppendText
+ *
+ * Add text to the end of an existing block with the same font and color.
+ * The new characters are measured on their own and offset by the width
+ * of the text already in the block.
+ */
+static int AppendText(RTF_Context *ctx, RTF_TextBlock *textBlock,
+        const char *text)
+{
+    int first = textBlock->numChars;
+    int byteBase = SDL_strlen(textBlock->text);
+    int pixelBase = textBlock->pixelOffsets[first];
+    int length = SDL_strlen(text);
+    int numChars = first + length + 1;
+    int i, num;
+    char *newText;
+    int *offsets;
+
+    newText = (char *) RTF_realloc(ctx, textBlock->text,
+            byteBase + length + 1);
+    if (!newText)
+        return ecStackOverflow;
+    SDL_memcpy(newText + byteBase, text, length + 1);
+    textBlock->text = newText;
+
+    offsets = (int *) RTF_realloc(ctx, textBlock->byteOffsets,
+            numChars * sizeof(int));
+    if (!offsets)
+        return ecStackOverflow;
+    textBlock->byteOffsets = offsets;
+    offsets = (int *) RTF_realloc(ctx, textBlock->pixelOffsets,
+            numChars * sizeof(int));
+    if (!offsets)
+        return ecStackOverflow;
+    textBlock->pixelOffsets = offsets;
+
+    num = RTF_GetCharacterOffsets(ctx->fontEngine, textBlock->font, text,
+            &textBlock->byteOffsets[first], &textBlock->pixelOffsets[first],
+            length + 1);
+    for (i = first; i <= first + num; ++i)
+    {
+        textBlock->byteOffsets[i] += byteBase;
+        textBlock->pixelOffsets[i] += pixelBase;
+    }
+    textBlock->numChars = first + num;
+
+#ifdef DEBUG_RTF
+    fprintf(stderr, "Appended text: '%s'\n", text);
+#endif
+    return FindBreaks(ctx, textBlock, first);
+}
+
+/*
+ * %%Function: AddLineLike
+ *
+ * Start a new line at the end of the document, with the formatting of an
+ * existing line.
+ */
+static int AddLineLike(RTF_Context *ctx, int index)
+{
+    RTF_Line *line;
+
+    if (ecGrowArray(ctx, (void **)&ctx->lines, &ctx->maxLines,
+            ctx->numLines, sizeof(*line)) != ecOK)
+        return ecStackOverflow;
+    line = &ctx->lines[ctx->numLines++];
+
+    *line = ctx->lines[index];
+    line->tabs = 0;
+    line->block = ctx->numBlocks;
+    line->numBlocks = 0;
+    return ecOK;
+}
+
+/*
+ * %%Function: CopyText
+ *
+ * Add characters from..to of a line to the last line, keeping their fonts
+ * and colors.  A to of -1 copies to the end of the line.  Tabs before a
+ * block of text are copied along with its first character.
+ */
+static int CopyText(RTF_Context *ctx, int index, int from, int to)
+{
+    int block = ctx->lines[index].block;
+    int numBlocks = ctx->lines[index].numBlocks;
+    int i, start = 0;
+
+    for (i = 0; i < numBlocks; ++i)
+    {
+        RTF_TextBlock *textBlock = &ctx->blocks[block + i];
+        int first = SDL_max(from - start, 0);
+        int last = textBlock->numChars;
+        char *end;
+        char ch;
+        int status;
+
+        if (to >= 0)
+            last = SDL_min(to - start, last);
+        start += textBlock->numChars;
+        if (first >= last)
+            continue;
+
+        if (first == 0)
+            ctx->lines[ctx->numLines - 1].tabs += textBlock->tabs;
+
+        /* Adding the text can move the blocks, but not their text */
+        end = &textBlock->text[textBlock->byteOffsets[last]];
+        ch = *end;
+        *end = '\0';
+        status = AddText(ctx, textBlock->font, textBlock->color,
+                &textBlock->text[textBlock->byteOffsets[first]]);
+        *end = ch;
+        if (status != ecOK)
+            return status;
+    }
+    return ecOK;
+}
+
+/*
+ * %%Function: FindTextStyle
+ *
+ * Find the font and color of the character before offset in a line, or of
+ * the first character if there is none before it.  A line without text
+ * uses the current font and color.
+ */
+static int FindTextStyle(RTF_Context *ctx, int index, int offset,
+        void **font, SDL_Color *color)
+{
+    RTF_Line *line = &ctx->lines[index];
+    int i;
+
+    for (i = 0; i < line->numBlocks; ++i)
+    {
+        RTF_TextBlock *textBlock = &ctx->blocks[line->block + i];
+
+        if (offset <= textBlock->numChars || i == line->numBlocks - 1)
+        {
+            *font = textBlock->font;
+            *color = textBlock->color;
+            return ecOK;
+        }
+        offset -= textBlock->numChars;
+    }
+
+    *font = ecLookupFont(ctx);
+    *color = ecLookupColor(ctx);
+    return *font ? ecOK : ecFontNotFound;
+}
+
+/*
+ * %%Function: SpliceLines
+ *
+ * Move the lines from firstNew to the end of the document, and their text
+ * blocks, in place of numOld lines starting at index.  The lines and text
+ * blocks after the old ones are moved to make room, and the text blocks of
+ * the old lines are freed.
+ */
+static int SpliceLines(RTF_Context *ctx, int index, int numOld,
+        int firstNew, RTF_Edit *edit)
+{
+    RTF_Line *lastOld = &ctx->lines[index + numOld - 1];
+    int numNew = ctx->numLines - firstNew;
+    int firstBlock = ctx->lines[firstNew].block;
+    int numNewBlocks = ctx->numBlocks - firstBlock;
+    int oldBlock = ctx->lines[index].block;
+    int numOldBlocks = lastOld->block + lastOld->numBlocks - oldBlock;
+    int blockDelta = numNewBlocks - numOldBlocks;
+    RTF_Line *lines;
+    RTF_TextBlock *blocks = NULL;
+    int i;
+
+    lines = (RTF_Line *) RTF_malloc(ctx, numNew * sizeof(*lines));
+    if (numNewBlocks)
+        blocks = (RTF_TextBlock *) RTF_malloc(ctx,
+                numNewBlocks * sizeof(*blocks));
+    if (!lines || (numNewBlocks && !blocks))
+    {
+        RTF_free(ctx, lines);
+        RTF_free(ctx, blocks);
+        return ecStackOverflow;
+    }
+    SDL_memcpy(lines, &ctx->lines[firstNew], numNew * sizeof(*lines));
+    if (numNewBlocks)
+        SDL_memcpy(blocks, &ctx->blocks[firstBlock],
+                numNewBlocks * sizeof(*blocks));
+    ctx->numLines = firstNew;
+    ctx->numBlocks = firstBlock;
+
+    for (i = 0; i < numOldBlocks; ++i)
+    {
+        FreeTextBlock(ctx, &ctx->blocks[oldBlock + i]);
+    }
+
+    SDL_memmove(&ctx->lines[index + numNew], &ctx->lines[index + numOld],
+            (ctx->numLines - index - numOld) * sizeof(*lines));
+    SDL_memmove(&ctx->blocks[oldBlock + numNewBlocks],
+            &ctx->blocks[oldBlock + numOldBlocks],
+            (ctx->numBlocks - oldBlock - numOldBlocks) * sizeof(*blocks));
+    SDL_memcpy(&ctx->lines[index], lines, numNew * sizeof(*lines));
+    if (numNewBlocks)
+        SDL_memcpy(&ctx->blocks[oldBlock], blocks,
+                numNewBlocks * sizeof(*blocks));
+    ctx->numLines += numNew - numOld;
+    ctx->numBlocks += blockDelta;
+
+    for (i = 0; i < numNew; ++i)
+    {
+        ctx->lines[index + i].block += oldBlock - firstBlock;
+    }
+    for (i = index + numNew; i < ctx->numLines; ++i)
+    {
+        ctx->lines[i].block += blockDelta;
+    }
+    RTF_free(ctx, lines);
+    RTF_free(ctx, blocks);
+
+    edit->line = index;
+    edit->numOld = numOld;
+    edit->numNew = numNew;
+    edit->blockDelta = blockDelta;
+    return ecOK;
+}
+
+/*
+ * %%Function: DiscardLines
+ *
+ * Throw away lines and text blocks added for an edit that failed.
+ */
+static void DiscardLines(RTF_Context *ctx, int firstNew, int firstBlock)
+{
+    while (ctx->numBlocks > firstBlock)
+    {
+        FreeTextBlock(ctx, &ctx->blocks[--ctx->numBlocks]);
+    }
+    ctx->numLines = firstNew;
+}
+
+/*
+ * %%Function: SaveDocument
+ *
+ * Move the document out of the context, leaving it empty and ready to
+ * parse another one.
+ */
+static void SaveDocument(RTF_Context *ctx, RTF_Document *doc)
+{
+    doc->fontTable = ctx->fontTable;
+    doc->colorTable = ctx->colorTable;
+    doc->title = ctx->title;
+    doc->subject = ctx->subject;
+    doc->author = ctx->author;
+    doc->cGroup = ctx->cGroup;
+    doc->rds = ctx->rds;
+    doc->ris = ctx->ris;
+    doc->chp = ctx->chp;
+    doc->pap = ctx->pap;
+    doc->sep = ctx->sep;
+    doc->dop = ctx->dop;
+    doc->psave = ctx->psave;
+    doc->lines = ctx->lines;
+    doc->numLines = ctx->numLines;
+    doc->maxLines = ctx->maxLines;
+    doc->blocks = ctx->blocks;
+    doc->numBlocks = ctx->numBlocks;
+    doc->maxBlocks = ctx->maxBlocks;
+
+    ctx->fontTable = NULL;
+    ctx->colorTable = NULL;
+    ctx->title = NULL;
+    ctx->subject = NULL;
+    ctx->author = NULL;
+    ctx->cGroup = 0;
+    ctx->rds = rdsNorm;
+    ctx->ris = risNorm;
+    SDL_memset(&ctx->chp, 0, sizeof(ctx->chp));
+    SDL_memset(&ctx->pap, 0, sizeof(ctx->pap));
+    SDL_memset(&ctx->sep, 0, sizeof(ctx->sep));
+    SDL_memset(&ctx->dop, 0, sizeof(ctx->dop));
+    ctx->psave = NULL;
+    ctx->lines = NULL;
+    ctx->numLines = 0;
+    ctx->maxLines = 0;
+    ctx->blocks = NULL;
+    ctx->numBlocks = 0;
+    ctx->maxBlocks = 0;
+}
+
+/*
+ * %%Function: RestoreDocument
+ *
+ * Move a saved document back into a context that has none.
+ */
+static void RestoreDocument(RTF_Context *ctx, const RTF_Document *doc)
+{
+    ctx->fontTable = doc->fontTable;
+    ctx->colorTable = doc->colorTable;
+    ctx->title = doc->title;
+    ctx->subject = doc->subject;
+    ctx->author = doc->author;
+    ctx->cGroup = doc->cGroup;
+    ctx->rds = doc->rds;
+    ctx->ris = doc->ris;
+    ctx->chp = doc->chp;
+    ctx->pap = doc->pap;
+    ctx->sep = doc->sep;
+    ctx->dop = doc->dop;
+    ctx->psave = doc->psave;
+    ctx->lines = doc->lines;
+    ctx->numLines = doc->numLines;
+    ctx->maxLines = doc->maxLines;
+    ctx->blocks = doc->blocks;
+    ctx->numBlocks = doc->numBlocks;
+    ctx->maxBlocks = doc->maxBlocks;
+}
+
+/*
+ * %%Function: FreeDocument
+ *
+ * Free everything the document in the context uses, including its arrays.
+ * The layouts are left alone.
+ */
+static void FreeDocument(RTF_Context *ctx)
+{
+    int i;
+
+    while (ctx->psave)
     {
-        RTF_TextBlock *text = line->start;
+        ecPopRtfState(ctx);
+    }
+    ecClearFonts(ctx);
+    ecClearColors(ctx);
+
+    RTF_free(ctx, ctx->title);
+    RTF_free(ctx, ctx->subject);
+    RTF_free(ctx, ctx->author);
+    ctx->title = NULL;
+    ctx->subject = NULL;
+    ctx->author = NULL;
 
-        line->start = text->next;
-        FreeTextBlock(text);
+    for (i = 0; i < ctx->numBlocks; ++i)
+    {
+        FreeTextBlock(ctx, &ctx->blocks[i]);
     }
-    SDL_free(line);
+    RTF_free(ctx, ctx->blocks);
+    ctx->blocks = NULL;
+    ctx->numBlocks = 0;
+    ctx->maxBlocks = 0;
+
+    RTF_free(ctx, ctx->lines);
+    ctx->lines = NULL;
+    ctx->numLines = 0;
+    ctx->maxLines = 0;
+}
+
+/*
+ * %%Function: RTF_HashBytes
+ *
+ * Add bytes to a 64-bit FNV-1a hash, started from RTF_HASH_INIT.
+ */
+Uint64 RTF_HashBytes(Uint64 hash, const void *data, size_t size)
+{
+    const Uint8 *bytes = (const Uint8 *) data;
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * %%Function: HashLine
+ *
+ * Hash everything that goes into the layout of a line: its paragraph
+ * properties, and the text of each block along with its font instance,
+ * color and tabs.
+ */
+static Uint64 HashLine(const RTF_Line *line, const RTF_TextBlock *blocks)
+{
+    const RTF_TextBlock *textBlock = &blocks[line->block];
+    const RTF_TextBlock *lastBlock = textBlock + line->numBlocks;
+    Uint64 hash = RTF_HASH_INIT;
+    int values[3];
+
+    values[0] = line->lineHeight;
+    values[1] = line->tabs;
+    values[2] = line->numBlocks;
+    hash = RTF_HashBytes(hash, &line->pap, sizeof(line->pap));
+    hash = RTF_HashBytes(hash, values, sizeof(values));
+    for (; textBlock < lastBlock; ++textBlock)
+    {
+        hash = RTF_HashBytes(hash, &textBlock->font,
+                sizeof(textBlock->font));
+        hash = RTF_HashBytes(hash, &textBlock->color,
+                sizeof(textBlock->color));
+        hash = RTF_HashBytes(hash, &textBlock->tabs,
+                sizeof(textBlock->tabs));
+        hash = RTF_HashBytes(hash, textBlock->text,
+                SDL_strlen(textBlock->text) + 1);
+    }
+    return hash;
+}
+
+/*
+ * Compare two lines with equal hashes.  A line whose layout is kept has
+ * its old text offsets used with the new text, so a hash collision must
+ * never be taken for a match.
+ */
+static bool SameLine(const RTF_Line *a, const RTF_TextBlock *aBlocks,
+        const RTF_Line *b, const RTF_TextBlock *bBlocks)
+{
+    const RTF_TextBlock *aBlock = &aBlocks[a->block];
+    const RTF_TextBlock *bBlock = &bBlocks[b->block];
+    int i;
+
+    if (SDL_memcmp(&a->pap, &b->pap, sizeof(a->pap)) != 0 ||
+            a->lineHeight != b->lineHeight || a->tabs != b->tabs ||
+            a->numBlocks != b->numBlocks)
+        return false;
+    for (i = 0; i < a->numBlocks; ++i, ++aBlock, ++bBlock)
+    {
+        if (aBlock->font != bBlock->font ||
+                SDL_memcmp(&aBlock->color, &bBlock->color,
+                    sizeof(aBlock->color)) != 0 ||
+                aBlock->tabs != bBlock->tabs ||
+                SDL_strcmp(aBlock->text, bBlock->text) != 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * %%Function: MatchLines
+ *
+ * Find the lines of the new document in the context that are the same as
+ * lines of the old one, in the same order.  Unchanged lines at the start
+ * and end are matched first.  Between them, each new line is looked for a
+ * little way past the last match, which finds the unchanged lines between
+ * several separate edits.
+ */
+static int MatchLines(RTF_Context *ctx, const RTF_Document *old,
+        RTF_LineMatch *matches)
+{
+    int numOld = old->numLines;
+    int numNew = ctx->numLines;
+    Uint64 *oldHashes, *newHashes;
+    int start, end, last, i, j;
+
+    oldHashes = (Uint64 *) RTF_malloc(ctx,
+            (numOld + numNew + 1) * sizeof(*oldHashes));
+    if (!oldHashes)
+        return ecStackOverflow;
+    newHashes = oldHashes + numOld;
+    for (i = 0; i < numOld; ++i)
+    {
+        oldHashes[i] = HashLine(&old->lines[i], old->blocks);
+    }
+    for (j = 0; j < numNew; ++j)
+    {
+        newHashes[j] = HashLine(&ctx->lines[j], ctx->blocks);
+        matches[j].line = -1;
+        matches[j].block = 0;
+    }
+
+    for (start = 0; start < numOld && start < numNew; ++start)
+    {
+        if (oldHashes[start] != newHashes[start] ||
+                !SameLine(&old->lines[start], old->blocks,
+                    &ctx->lines[start], ctx->blocks))
+            break;
+        matches[start].line = start;
+    }
+    for (end = 0; end < numOld - start && end < numNew - start; ++end)
+    {
+        if (oldHashes[numOld - 1 - end] != newHashes[numNew - 1 - end] ||
+                !SameLine(&old->lines[numOld - 1 - end], old->blocks,
+                    &ctx->lines[numNew - 1 - end], ctx->blocks))
+            break;
+        matches[numNew - 1 - end].line = numOld - 1 - end;
+    }
+
+    i = start;
+    for (j = start; j < numNew - end; ++j)
+    {
+        int k;
+
+        last = SDL_min(i + RTF_RELOAD_MATCH_WINDOW, numOld - end);
+        for (k = i; k < last; ++k)
+        {
+            if (oldHashes[k] == newHashes[j] &&
+                    SameLine(&old->lines[k], old->blocks,
+                        &ctx->lines[j], ctx->blocks))
+                break;
+        }
+        if (k < last)
+        {
+            matches[j].line = k;
+            i = k + 1;
+        }
+    }
+
+    for (j = 0; j < numNew; ++j)
+    {
+        if (matches[j].line >= 0)
+            matches[j].block = old->lines[matches[j].line].block;
+    }
+    RTF_free(ctx, oldHashes);
+    return ecOK;
 }
 
-static void FreeTextBlock(RTF_TextBlock *text)
+static void FreeTextBlock(RTF_Context *ctx, RTF_TextBlock *text)
 {
-    SDL_free(text->text);
-    SDL_free(text->byteOffsets);
-    SDL_free(text->pixelOffsets);
-    SDL_free(text);
+    RTF_free(ctx, text->text);
+    RTF_free(ctx, text->byteOffsets);
+    RTF_free(ctx, text->pixelOffsets);
+    RTF_free(ctx, text->breaks);
 }
 
 /* vi: set ts=4 sw=4 expandtab: */
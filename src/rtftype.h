@@ -108,7 +108,6 @@ typedef struct save             /* property save structure */
     CHP chp;
     PAP pap;
     SEP sep;
-    DOP dop;
     RDS rds;
     RIS ris;
 }
@@ -260,6 +259,19 @@ typedef enum
     RTF_FontUnderline = 0x04
 }
 RTF_FontStyle;
+
+typedef struct _RTF_Allocator
+{
+    void *(SDLCALL *malloc_func)(void *userdata, size_t size);
+    void *(SDLCALL *realloc_func)(void *userdata, void *mem, size_t size);
+    void (SDLCALL *free_func)(void *userdata, void *mem);
+    void *userdata;
+}
+RTF_Allocator;
+
+struct _RTF_Context;
+typedef void (SDLCALL *RTF_LayoutCallback)(void *userdata,
+        struct _RTF_Context *ctx, int width);
 #endif /* !SDL_RTF_H_ */
 
 typedef struct _RTF_Font
@@ -271,6 +283,32 @@ typedef struct _RTF_Font
 }
 RTF_Font;
 
+#define RTF_DEFAULT_FONT_CACHE_TIMEOUT  10000   /* milliseconds */
+#define RTF_DEFAULT_LAYOUT_CACHE_COUNT  4
+#define RTF_DEFAULT_LAYOUT_CACHE_BYTES  (64 * 1024 * 1024)
+
+/* Letter paper with the default RTF margins, for documents that don't set
+   their own page geometry.  In twips. */
+#define RTF_DEFAULT_PAGE_WIDTH      12240
+#define RTF_DEFAULT_PAGE_HEIGHT     15840
+#define RTF_DEFAULT_MARGIN_LEFT     1800
+#define RTF_DEFAULT_MARGIN_RIGHT    1800
+#define RTF_DEFAULT_MARGIN_TOP      1440
+#define RTF_DEFAULT_MARGIN_BOTTOM   1440
+
+typedef struct _RTF_CachedFont
+{
+    char *name;
+    RTF_FontFamily family;
+    int charset;
+    int size;
+    int style;
+    void *font;
+    Uint64 key;                 /* the same for the same font in any context */
+    Uint64 lastUsed;            /* when a document last used this font */
+}
+RTF_CachedFont;
+
 typedef struct _RTF_FontEntry
 {
     int number;
@@ -284,11 +322,7 @@ RTF_FontEntry;
 
 typedef struct _RTF_ColorEntry
 {
-    void *color;
-    unsigned char r;
-    unsigned char g;
-    unsigned char b;
-    unsigned char a; /* unused */
+    SDL_Color color;
     struct _RTF_ColorEntry *next;
 }
 RTF_ColorEntry;
@@ -297,44 +331,141 @@ typedef struct _RTF_TextBlock
 {
     void *font;
 
-    void *color;
+    SDL_Color color;            /* by value, so it outlives the color table */
     int tabs;
     char *text;
     int numChars;
     int *byteOffsets;
-    int *pixelOffsets;
+    int *pixelOffsets;          /* prefix widths, numChars + 1 of them */
+    int *breaks;                /* where the text can wrap, in order */
+    int numBreaks;
     int lineHeight;
-    struct _RTF_TextBlock *next;
 }
 RTF_TextBlock;
 
+/* A piece of a text block laid out on a single row.  The texture is only
+   created when the piece is first drawn, and may be evicted from the
+   texture cache and created again later. */
 typedef struct _RTF_Surface
 {
-    int x, y;
-    void *surface;
-    struct _RTF_Surface *next;
+    int block;                  /* index of the text block */
+    int offset;                 /* first character in the text block */
+    int numChars;
+    int x, y;                   /* position in the line */
+    int w, h;                   /* size of the texture, or of the text
+                                   until the texture is created */
+    int texture;                /* slot in the texture cache, or -1 */
+    Uint32 generation;          /* of the slot when the texture was added */
+    int atlasX, atlasY;         /* where the text is in its atlas page, or
+                                   -1 if the texture is its own */
+    void *text;                 /* made by the font engine, if it draws the
+                                   text itself */
+    bool modulated;             /* the texture is white, and the text is
+                                   colored when it's drawn */
 }
 RTF_Surface;
 
 typedef struct _RTF_Line
 {
     PAP pap;
-    int lineWidth;
-    int lineHeight;
+    int lineHeight;             /* height of the line if it has no text */
     int tabs;
-    RTF_TextBlock *start;
-    RTF_TextBlock *last;
-    RTF_Surface *startSurface;
-    RTF_Surface *lastSurface;
-    struct _RTF_Line *next;
+    int block;                  /* index of the first text block */
+    int numBlocks;
 }
 RTF_Line;
 
+/* Where a line ended up in a particular layout */
+typedef struct _RTF_LineLayout
+{
+    int y;                      /* sum of the heights of previous lines */
+    int lineWidth;
+    int lineHeight;
+    bool estimated;             /* height is a guess, line not yet laid out */
+    int surface;                /* index of the first surface */
+    int numSurfaces;
+}
+RTF_LineLayout;
+
+/* A strip of the layout drawn into a texture, so scrolling can draw a
+   few tiles instead of every piece of text */
+typedef struct _RTF_Tile
+{
+    int texture;                /* slot in the texture cache, or -1 */
+    Uint32 generation;
+}
+RTF_Tile;
+
+/* A piece of text rendered to a surface on a worker thread, waiting to be
+   uploaded to a texture */
+typedef struct _RTF_Raster
+{
+    RTF_Surface *surface;
+    void *font;
+    SDL_Surface *pixels;
+}
+RTF_Raster;
+
+/* The text laid out at a particular width */
+typedef struct _RTF_Layout
+{
+    int width;
+    int height;
+    RTF_LineLayout *lines;      /* one for each line of the document */
+    int maxLines;
+    RTF_Surface *surfaces;
+    int numSurfaces;
+    int maxSurfaces;
+    int numEstimated;           /* lines with an estimated height */
+    int refineLine;             /* where to continue refining estimates */
+    size_t textureBytes;        /* approximate size of the textures */
+    int droppedSurfaces;        /* surfaces no line uses any more */
+    RTF_Tile *tiles;            /* from the top, tileHeight apart */
+    int numTiles;
+    int maxTiles;
+}
+RTF_Layout;
+
+/* Where a page starts in the layout of the text at the page width.  A long
+   line can continue from one page to the next, so the page can start part
+   way into its first line. */
+typedef struct _RTF_Page
+{
+    int line;                   /* first line on the page */
+    int y;                      /* top of the page in the layout */
+}
+RTF_Page;
+
+/* Lines replaced by an edit of the document */
+typedef struct _RTF_Edit
+{
+    int line;                   /* index of the first line replaced */
+    int numOld;                 /* number of lines replaced */
+    int numNew;                 /* number of lines replacing them */
+    int blockDelta;             /* how far the text blocks after them moved */
+}
+RTF_Edit;
+
+/* Where a line of a reloaded document was before the reload */
+typedef struct _RTF_LineMatch
+{
+    int line;                   /* the unchanged line it matches, or -1 */
+    int block;                  /* index of that line's first text block */
+}
+RTF_LineMatch;
+
 struct _RTF_Context
 {
     void *renderer;
     void *fontEngine;
 
+    /* The engine the context was created with, which fontEngine is a
+       copy of.  Fonts made by the same engine are shared between contexts. */
+    const void *fontEngineInstance;
+
+    /* Used for every allocation made on behalf of this context */
+    RTF_Allocator allocator;
+
     /* Storage for parsing data */
     char *data;
     int datapos;
@@ -344,6 +475,12 @@ struct _RTF_Context
     RTF_FontEntry *fontTable;
     RTF_ColorEntry *colorTable;
 
+    /* Font instances, shared by all documents loaded into this context */
+    RTF_CachedFont *fontCache;
+    int numCachedFonts;
+    int maxCachedFonts;
+    Uint32 fontCacheTimeout;
+
     char *title;
     char *subject;
     char *author;
@@ -358,6 +495,7 @@ struct _RTF_Context
     DOP dop;
 
     SAVE *psave;
+    SAVE *psaveFree;            /* unused save structures, for reuse */
     long cbBin;
     long lParam;
     bool fSkipDestIfUnk;
@@ -367,10 +505,77 @@ struct _RTF_Context
     int nextch;
 
     /* Display information */
-    int displayWidth;
-    int displayHeight;
-    RTF_Line *start;
-    RTF_Line *last;
+    bool lazyLayout;            /* only lay out lines as they are needed */
+    int anchorLine;             /* top line of the last render */
+    int anchorOffset;           /* pixels scrolled into the top line */
+    int anchorHeight;           /* height of the top line at the time */
+    struct _RTF_WorkerPool *workers;    /* threads that help with reflow
+                                           and rendering text */
+    RTF_Raster *rasters;        /* text being rendered off the renderer */
+    int maxRasters;
+    int tileHeight;             /* height of tiles, or 0 to draw directly */
+    struct _RTF_Atlas *atlas;   /* pages the text is packed into, if any */
+    bool colorModulation;       /* render text in white, and color it when
+                                   it's drawn */
+
+    /* What the last render drew, to find out what the next one changes */
+    Uint32 layoutGeneration;    /* changes whenever the text moves */
+    bool rendered;
+    SDL_Rect renderRect;
+    int renderOffset;
+    Uint32 renderGeneration;
+    SDL_Rect damage;            /* the part the last render changed */
+
+    /* The last render kept in a texture, and a second one to scroll it
+       into, both handled like tiles */
+    bool compositeCache;
+    RTF_Tile composites[2];
+    int composite;              /* the one holding the last render */
+    size_t compositeBytes;
+    struct _RTF_TextureCache *textureCache; /* shared with the renderer's
+                                               other contexts */
+
+    /* Reflow to a new width in the background.  The thread owns
+       reflowLayout until it sets reflowDone. */
+    bool backgroundReflow;
+    SDL_Thread *reflowThread;
+    RTF_Layout *reflowLayout;
+    SDL_AtomicInt reflowDone;
+    int requestedWidth;         /* width of the most recent reflow request */
+    RTF_LayoutCallback layoutCallback;
+    void *layoutCallbackData;
+
+    /* Layouts at recently used widths, most recently used first.  The
+       first one is the current layout. */
+    RTF_Layout *layout;
+    RTF_Layout **layouts;
+    int numLayouts;
+    int maxLayouts;
+    RTF_Layout *spareLayout;    /* kept around to reuse its memory */
+    int layoutCacheCount;       /* most layouts to keep */
+    size_t layoutCacheBytes;    /* most memory to use for them */
+
+    /* The text laid out on pages, made when pages are first asked for.
+       The page layout is always exact, even with lazy layout. */
+    RTF_Layout *pageLayout;
+    RTF_Page *pages;
+    int numPages;
+    int maxPages;
+    int pageWidth;              /* size of the paper, in pixels */
+    int pageHeight;
+    SDL_Rect pageText;          /* where the text goes on the paper */
+
+    /* Lines and text blocks are kept in growable arrays, in document
+       order.  Each line refers to its text blocks by index, and each layout
+       has a matching array of line positions, so reflow and rendering walk
+       memory sequentially.
+     */
+    RTF_Line *lines;
+    int numLines;
+    int maxLines;
+    RTF_TextBlock *blocks;
+    int numBlocks;
+    int maxBlocks;
 };
 #ifndef SDL_RTF_H_
 typedef struct _RTF_Context RTF_Context;